@@ -0,0 +1,418 @@
+/*
+ * Micro-benchmarks of the uthreads scheduler against pthreads and ucontext.
+ *
+ * Every result is printed as one JSON object per line on stdout, e.g.
+ *   {"benchmark":"yield_pingpong","impl":"uthreads","param":0,"iterations":1000000,"ns_per_op":152.3}
+ * so that runs can be diffed and plotted. The library can only be initialized
+ * once per process, so each measurement runs in a forked child.
+ *
+ * Usage: uthreads_bench [--quick] [benchmark ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "uthreads.h"
+
+#define QUANTUM_USECS 1000 /* quantum of the preemption jitter benchmark */
+#define JITTER_GAP_NSECS 20000 /* pause between two clock reads that counts as being preempted */
+#define BASELINE_STACK_SIZE 65536
+
+static long scale_divisor = 1;
+
+static long iterations(long n) {
+    return std::max(n / scale_divisor, 1L);
+}
+
+static unsigned long long now_nsecs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char* benchmark, const char* impl, long param, long ops, unsigned long long nsecs) {
+    printf("{\"benchmark\":\"%s\",\"impl\":\"%s\",\"param\":%ld,\"iterations\":%ld,\"ns_per_op\":%.1f}\n",
+           benchmark, impl, param, ops, (double)nsecs / ops);
+    fflush(stdout);
+}
+
+static void init_uthreads(int timer_mode, int max_threads) {
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, timer_mode == UTHREAD_TIMER_NONE ? 0 : QUANTUM_USECS);
+    attr.timer_mode = timer_mode;
+    attr.max_threads = max_threads;
+    attr.pool_max = max_threads;
+    if (uthread_init_ex(&attr) != 0) {
+        exit(1);
+    }
+}
+
+// ================== Yield ping-pong =====================
+
+static long pingpong_rounds;
+
+static void* uthread_pingpong(void*) {
+    for (long i = 0; i < pingpong_rounds; i++) {
+        uthread_yield();
+    }
+    return nullptr;
+}
+
+/**
+ * Two uthreads yielding to each other: every yield is one context switch.
+ */
+static void bench_yield_uthreads() {
+    init_uthreads(UTHREAD_TIMER_NONE, 4);
+    pingpong_rounds = iterations(2000000);
+    int tid = uthread_spawn_arg(uthread_pingpong, nullptr);
+    unsigned long long start = now_nsecs();
+    for (long i = 0; i < pingpong_rounds; i++) {
+        uthread_yield();
+    }
+    unsigned long long elapsed = now_nsecs() - start;
+    uthread_join(tid, nullptr);
+    report("yield_pingpong", "uthreads", 0, 2 * pingpong_rounds, elapsed);
+}
+
+static pthread_mutex_t pingpong_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pingpong_cond = PTHREAD_COND_INITIALIZER;
+static int pingpong_turn = 0;
+
+static void pthread_pingpong_side(int me) {
+    pthread_mutex_lock(&pingpong_mutex);
+    for (long i = 0; i < pingpong_rounds; i++) {
+        while (pingpong_turn != me) {
+            pthread_cond_wait(&pingpong_cond, &pingpong_mutex);
+        }
+        pingpong_turn = 1 - me;
+        pthread_cond_signal(&pingpong_cond);
+    }
+    pthread_mutex_unlock(&pingpong_mutex);
+}
+
+static void* pthread_pingpong(void*) {
+    pthread_pingpong_side(1);
+    return nullptr;
+}
+
+/**
+ * Two kernel threads handing a turn back and forth through a condition variable.
+ */
+static void bench_yield_pthreads() {
+    pingpong_rounds = iterations(200000);
+    pthread_t other;
+    unsigned long long start = now_nsecs();
+    pthread_create(&other, nullptr, pthread_pingpong, nullptr);
+    pthread_pingpong_side(0);
+    pthread_join(other, nullptr);
+    report("yield_pingpong", "pthreads", 0, 2 * pingpong_rounds, now_nsecs() - start);
+}
+
+static ucontext_t uc_main;
+static ucontext_t uc_other;
+
+static void ucontext_pingpong() {
+    while (true) {
+        swapcontext(&uc_other, &uc_main);
+    }
+}
+
+/**
+ * Two ucontexts switching with swapcontext, which saves and restores the signal
+ * mask with a system call on every switch.
+ */
+static void bench_yield_ucontext() {
+    long rounds = iterations(1000000);
+    std::vector<char> stack(BASELINE_STACK_SIZE);
+    getcontext(&uc_other);
+    uc_other.uc_stack.ss_sp = stack.data();
+    uc_other.uc_stack.ss_size = stack.size();
+    uc_other.uc_link = nullptr;
+    makecontext(&uc_other, ucontext_pingpong, 0);
+    unsigned long long start = now_nsecs();
+    for (long i = 0; i < rounds; i++) {
+        swapcontext(&uc_main, &uc_other);
+    }
+    report("yield_pingpong", "ucontext", 0, 2 * rounds, now_nsecs() - start);
+}
+
+// ================== Spawn / terminate =====================
+
+static void* noop(void*) {
+    return nullptr;
+}
+
+/**
+ * Spawn a thread, let it run to completion and join it. Threads come from the
+ * pool once warm.
+ */
+static void bench_spawn_uthreads() {
+    init_uthreads(UTHREAD_TIMER_NONE, 4);
+    long rounds = iterations(500000);
+    unsigned long long start = now_nsecs();
+    for (long i = 0; i < rounds; i++) {
+        uthread_join(uthread_spawn_arg(noop, nullptr), nullptr);
+    }
+    report("spawn_terminate", "uthreads", 0, rounds, now_nsecs() - start);
+}
+
+static void bench_spawn_pthreads() {
+    long rounds = iterations(20000);
+    unsigned long long start = now_nsecs();
+    for (long i = 0; i < rounds; i++) {
+        pthread_t t;
+        pthread_create(&t, nullptr, noop, nullptr);
+        pthread_join(t, nullptr);
+    }
+    report("spawn_terminate", "pthreads", 0, rounds, now_nsecs() - start);
+}
+
+static void ucontext_noop() {}
+
+/**
+ * Create a context on a reused stack, as uthreads does with a warm pool, and
+ * run it to completion.
+ */
+static void bench_spawn_ucontext() {
+    long rounds = iterations(500000);
+    std::vector<char> stack(BASELINE_STACK_SIZE);
+    unsigned long long start = now_nsecs();
+    for (long i = 0; i < rounds; i++) {
+        getcontext(&uc_other);
+        uc_other.uc_stack.ss_sp = stack.data();
+        uc_other.uc_stack.ss_size = stack.size();
+        uc_other.uc_link = &uc_main;
+        makecontext(&uc_other, ucontext_noop, 0);
+        swapcontext(&uc_main, &uc_other);
+    }
+    report("spawn_terminate", "ucontext", 0, rounds, now_nsecs() - start);
+}
+
+// ================== Block / resume =====================
+
+static void idle_entry() {
+    uthread_terminate(uthread_get_tid());
+}
+
+/**
+ * uthread_block + uthread_resume of a READY thread while `queued` other READY
+ * threads wait in the ready queue. Without a timer none of them ever runs.
+ */
+static void bench_block_resume(long queued) {
+    init_uthreads(UTHREAD_TIMER_NONE, (int)queued + 2);
+    for (long i = 0; i < queued; i++) {
+        uthread_spawn(idle_entry);
+    }
+    int target = uthread_spawn(idle_entry);
+    long rounds = iterations(1000000);
+    unsigned long long start = now_nsecs();
+    for (long i = 0; i < rounds; i++) {
+        uthread_block(target);
+        uthread_resume(target);
+    }
+    report("block_resume", "uthreads", queued, rounds, now_nsecs() - start);
+}
+
+// ================== Sleep wake-up =====================
+
+static long sleep_rounds;
+
+static void* long_sleeper(void*) {
+    uthread_sleep_usecs(1 << 30);
+    return nullptr;
+}
+
+static void* short_sleeper(void*) {
+    for (long i = 0; i < sleep_rounds; i++) {
+        uthread_sleep_usecs(0);
+    }
+    return nullptr;
+}
+
+/**
+ * A thread sleeping for 0 micro-seconds over and over while other threads sleep
+ * for a long time: one sleep queue insertion, expiry and switch back per round.
+ */
+static void bench_sleep_wakeup(long sleepers) {
+    init_uthreads(UTHREAD_TIMER_NONE, (int)sleepers + 2);
+    for (long i = 0; i < sleepers; i++) {
+        uthread_spawn_arg(long_sleeper, nullptr);
+    }
+    // Let them all fall asleep
+    uthread_yield();
+    sleep_rounds = iterations(500000);
+    unsigned long long start = now_nsecs();
+    uthread_join(uthread_spawn_arg(short_sleeper, nullptr), nullptr);
+    report("sleep_wakeup", "uthreads", sleepers, sleep_rounds, now_nsecs() - start);
+}
+
+static void bench_sleep_pthreads() {
+    long rounds = iterations(100000);
+    struct timespec zero = {0, 0};
+    unsigned long long start = now_nsecs();
+    for (long i = 0; i < rounds; i++) {
+        nanosleep(&zero, nullptr);
+    }
+    report("sleep_wakeup", "pthreads", 0, rounds, now_nsecs() - start);
+}
+
+// ================== Preemption jitter =====================
+
+static volatile bool jitter_done = false;
+static std::vector<double> slices;
+static long slice_count;
+
+/**
+ * Spin reading the clock; a gap between two reads means the thread was
+ * preempted, and the time between two gaps is one slice.
+ */
+static void* jitter_measure(void*) {
+    unsigned long long last = now_nsecs();
+    unsigned long long slice_start = 0;
+    while ((long)slices.size() < slice_count) {
+        unsigned long long t = now_nsecs();
+        if (t - last > JITTER_GAP_NSECS) {
+            if (slice_start) {
+                slices.push_back((last - slice_start) / 1000.0);
+            }
+            slice_start = t;
+        }
+        last = t;
+    }
+    jitter_done = true;
+    return nullptr;
+}
+
+static void* jitter_spin(void*) {
+    while (!jitter_done) {}
+    return nullptr;
+}
+
+/**
+ * Length of the slices a CPU-bound thread gets next to another one, against
+ * the quantum, for the given timer mode.
+ */
+static void bench_preempt_jitter(long mode) {
+    init_uthreads((int)mode, 4);
+    slice_count = iterations(500);
+    slices.reserve(slice_count);
+    int measure = uthread_spawn_arg(jitter_measure, nullptr);
+    int spin = uthread_spawn_arg(jitter_spin, nullptr);
+    uthread_join(measure, nullptr);
+    uthread_join(spin, nullptr);
+    double sum = 0;
+    std::vector<double> deviations;
+    for (double s : slices) {
+        sum += s;
+        deviations.push_back(std::fabs(s - QUANTUM_USECS));
+    }
+    double mean = sum / slices.size();
+    double variance = 0;
+    for (double s : slices) {
+        variance += (s - mean) * (s - mean);
+    }
+    std::sort(deviations.begin(), deviations.end());
+    printf("{\"benchmark\":\"preempt_jitter\",\"impl\":\"uthreads\",\"param\":%ld,\"iterations\":%zu,"
+           "\"quantum_us\":%d,\"mean_slice_us\":%.1f,\"stddev_us\":%.1f,\"p50_dev_us\":%.1f,"
+           "\"p99_dev_us\":%.1f,\"max_dev_us\":%.1f}\n",
+           mode, slices.size(), QUANTUM_USECS, mean, std::sqrt(variance / slices.size()),
+           deviations[deviations.size() / 2], deviations[deviations.size() * 99 / 100], deviations.back());
+    fflush(stdout);
+}
+
+// ================== Driver =====================
+
+struct Benchmark {
+    const char* name;
+    void (*run)(long param);
+    long param;
+};
+
+static void run_yield_uthreads(long) { bench_yield_uthreads(); }
+static void run_yield_pthreads(long) { bench_yield_pthreads(); }
+static void run_yield_ucontext(long) { bench_yield_ucontext(); }
+static void run_spawn_uthreads(long) { bench_spawn_uthreads(); }
+static void run_spawn_pthreads(long) { bench_spawn_pthreads(); }
+static void run_spawn_ucontext(long) { bench_spawn_ucontext(); }
+static void run_sleep_pthreads(long) { bench_sleep_pthreads(); }
+
+static const Benchmark benchmarks[] = {
+    {"yield_pingpong", run_yield_uthreads, 0},
+    {"yield_pingpong", run_yield_pthreads, 0},
+    {"yield_pingpong", run_yield_ucontext, 0},
+    {"spawn_terminate", run_spawn_uthreads, 0},
+    {"spawn_terminate", run_spawn_pthreads, 0},
+    {"spawn_terminate", run_spawn_ucontext, 0},
+    {"block_resume", bench_block_resume, 0},
+    {"block_resume", bench_block_resume, 64},
+    {"block_resume", bench_block_resume, 1024},
+    {"block_resume", bench_block_resume, 16384},
+    {"sleep_wakeup", bench_sleep_wakeup, 0},
+    {"sleep_wakeup", bench_sleep_wakeup, 64},
+    {"sleep_wakeup", bench_sleep_wakeup, 1024},
+    {"sleep_wakeup", bench_sleep_wakeup, 16384},
+    {"sleep_wakeup", run_sleep_pthreads, 0},
+    {"preempt_jitter", bench_preempt_jitter, UTHREAD_TIMER_PROCESS},
+    {"preempt_jitter", bench_preempt_jitter, UTHREAD_TIMER_THREAD_CPU},
+    {"preempt_jitter", bench_preempt_jitter, UTHREAD_TIMER_WALL},
+};
+
+static bool known(const char* name) {
+    for (const Benchmark& b : benchmarks) {
+        if (strcmp(b.name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool selected(const char* name, int argc, char** argv, int first) {
+    if (first == argc) {
+        return true;
+    }
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    int first = 1;
+    if (first < argc && strcmp(argv[first], "--quick") == 0) {
+        scale_divisor = 20;
+        first++;
+    }
+    for (int i = first; i < argc; i++) {
+        if (!known(argv[i])) {
+            fprintf(stderr, "usage: %s [--quick] [benchmark ...]\nunknown benchmark: %s\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+    int failures = 0;
+    for (const Benchmark& b : benchmarks) {
+        if (!selected(b.name, argc, argv, first)) {
+            continue;
+        }
+        pid_t child = fork();
+        if (child == 0) {
+            b.run(b.param);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status = 0;
+        if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "uthreads_bench: %s (param %ld) failed\n", b.name, b.param);
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * test10.cc - Stackless C++20 coroutines (uthreads_coro.h, build with -std=c++20): the main thread waits for task
+ * results with uthread::block_on while two spawned coroutines take turns on the carrier thread, a task awaits child
+ * tasks, and an exception reaches the waiting thread. Runs on a single worker without preemption
+ * (UTHREAD_TIMER_NONE), so the order of the lines is fixed.
+ *
+ * Output should be:
+ * test10:
+ * --------------
+ * block_on(answer()): 42
+ * a 1
+ * b 1
+ * a 2
+ * b 2
+ * a 3
+ * b 3
+ * block_on(sum_of_children(5)): 15
+ * slept: yes
+ * block_on(failing()) threw: boom
+ *
+ */
+
+#include <stdio.h>
+#include <chrono>
+#include <stdexcept>
+#include "uthreads_coro.h"
+
+uthread::task<int> answer()
+{
+    co_return 42;
+}
+
+/* Prints its steps, letting the other coroutines run in between. */
+uthread::task<> stepper(const char* name, int* finished)
+{
+    for (int i = 1; i <= 3; i++) {
+        printf("%s %d\n", name, i);
+        co_await uthread::yield();
+    }
+    (*finished)++;
+}
+
+uthread::task<int> child(int i)
+{
+    co_await uthread::yield();
+    co_return i;
+}
+
+uthread::task<int> sum_of_children(int n)
+{
+    int sum = 0;
+    for (int i = 1; i <= n; i++) {
+        sum += co_await child(i);
+    }
+    co_return sum;
+}
+
+uthread::task<bool> nap()
+{
+    auto start = std::chrono::steady_clock::now();
+    co_await uthread::sleep_for(std::chrono::milliseconds(10));
+    co_return std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(10);
+}
+
+uthread::task<int> failing()
+{
+    co_await uthread::yield();
+    throw std::runtime_error("boom");
+}
+
+int main(void)
+{
+    printf("test10:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+
+    printf("block_on(answer()): %d\n", uthread::block_on(answer()));
+
+    int finished = 0;
+    if (uthread::spawn(stepper("a", &finished)) == -1 || uthread::spawn(stepper("b", &finished)) == -1)
+        fprintf(stderr, "unjustified failure to spawn a task\n");
+    while (finished < 2) {
+        uthread_yield();
+    }
+
+    printf("block_on(sum_of_children(5)): %d\n", uthread::block_on(sum_of_children(5)));
+    printf("slept: %s\n", uthread::block_on(nap()) ? "yes" : "no");
+    try {
+        uthread::block_on(failing());
+        printf("block_on(failing()) returned\n");
+    } catch (const std::runtime_error& e) {
+        printf("block_on(failing()) threw: %s\n", e.what());
+    }
+
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
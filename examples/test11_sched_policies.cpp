@@ -0,0 +1,122 @@
+/*
+ * test11.cc - Scheduling policies. The policy is chosen once, at uthread_init_ex, so each part runs in a child
+ * process of its own. Under UTHREAD_SCHED_EDF threads with a deadline run in deadline order, ahead of the thread
+ * without one; under UTHREAD_SCHED_FAIR a thread ten priority levels up gets about nine times the CPU time of a
+ * default one. Both run on a single worker without preemption (UTHREAD_TIMER_NONE): the FAIR threads yield after
+ * every equal piece of work, so the number of turns each gets follows its share (the check asks for only three times
+ * as many, since run time is measured on the wall clock and a busy machine adds noise).
+ *
+ * Output should be:
+ * test11:
+ * --------------
+ * EDF:
+ * deadline 100 ms
+ * deadline 200 ms
+ * deadline 300 ms
+ * no deadline
+ * FAIR:
+ * low priority ran: yes
+ * high priority got at least 3 times the turns: yes
+ *
+ */
+
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define FAIR_TURNS 3000
+
+void init(int policy)
+{
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    attr.sched_policy = policy;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        _exit(1);
+    }
+}
+
+void* say(void* arg)
+{
+    printf("%s\n", (const char*)arg);
+    return arg;
+}
+
+void edf()
+{
+    init(UTHREAD_SCHED_EDF);
+    const char* names[] = {"deadline 300 ms", "no deadline", "deadline 100 ms", "deadline 200 ms"};
+    int deadlines[] = {300000, -1, 100000, 200000};
+    int tids[4];
+    for (int i = 0; i < 4; i++) {
+        tids[i] = uthread_spawn_arg(say, (void*)names[i]);
+        if (tids[i] == -1 || uthread_set_deadline(tids[i], deadlines[i]) == -1)
+            fprintf(stderr, "unjustified failure to spawn\n");
+    }
+    for (int i = 0; i < 4; i++) {
+        uthread_join(tids[i], NULL);
+    }
+}
+
+int turns_left = FAIR_TURNS;
+volatile unsigned long work_sink;
+
+/* Takes equal turns of work until FAIR_TURNS turns have been taken in all, and returns its own number of turns. */
+void* take_turns(void* arg)
+{
+    long turns = 0;
+    while (turns_left > 0) {
+        turns_left--;
+        turns++;
+        for (int i = 0; i < 20000; i++) {
+            work_sink += i;
+        }
+        uthread_yield();
+    }
+    (void)arg;
+    return (void*)turns;
+}
+
+void fair()
+{
+    init(UTHREAD_SCHED_FAIR);
+    int high = uthread_spawn_arg(take_turns, NULL);
+    int low = uthread_spawn_arg(take_turns, NULL);
+    if (high == -1 || low == -1 || uthread_set_priority(high, UTHREAD_PRIORITY_DEFAULT + 10) == -1)
+        fprintf(stderr, "unjustified failure to spawn\n");
+    void* high_turns = NULL;
+    void* low_turns = NULL;
+    uthread_join(high, &high_turns);
+    uthread_join(low, &low_turns);
+    printf("low priority ran: %s\n", (long)low_turns > 0 ? "yes" : "no");
+    printf("high priority got at least 3 times the turns: %s\n",
+           (long)high_turns >= 3 * (long)low_turns ? "yes" : "no");
+}
+
+/* Runs part in a child process, which needs a library of its own. */
+void run_child(const char* title, void (*part)())
+{
+    printf("%s\n", title);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        part();
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fprintf(stderr, "unjustified failure of the %s child\n", title);
+}
+
+int main(void)
+{
+    printf("test11:\n--------------\n");
+    fflush(stdout);
+    run_child("EDF:", edf);
+    run_child("FAIR:", fair);
+    return 0;
+}
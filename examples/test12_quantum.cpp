@@ -0,0 +1,70 @@
+/*
+ * test12.cc - Per-thread quantums: two CPU-bound threads, one given 2 ms quantums and the other 8 ms with
+ * uthread_set_quantum, spin until each was preempted 10 times, and compare their average slices from uthread_stats.
+ * Runs on a single worker with a wall-clock timer (UTHREAD_TIMER_WALL), the clock uthread_stats measures run time
+ * on, so that the ratio holds on a busy machine too; only the main thread prints, after joining them.
+ *
+ * Output should be:
+ * test12:
+ * --------------
+ * short thread preempted 10 times
+ * long thread preempted 10 times
+ * long slices at least twice as long: yes
+ *
+ */
+
+#include <stdio.h>
+#include "uthreads.h"
+
+#define SHORT_QUANTUM 2000
+#define LONG_QUANTUM 8000
+#define PREEMPTIONS 10
+
+struct slices {
+    long preemptions;
+    double average_usecs;
+};
+
+/* Spins until preempted PREEMPTIONS times, then reports its average slice. */
+void* spin(void* arg)
+{
+    slices* out = (slices*)arg;
+    int tid = uthread_get_tid();
+    uthread_stats_t stats;
+    do {
+        uthread_stats(tid, &stats);
+    } while (stats.switches[UTHREAD_SWITCH_PREEMPT] < PREEMPTIONS);
+    out->preemptions = (long)stats.switches[UTHREAD_SWITCH_PREEMPT];
+    out->average_usecs = stats.run_cycles / stats.cycles_per_usec / (out->preemptions + 1);
+    return arg;
+}
+
+int main(void)
+{
+    printf("test12:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 4000);
+    attr.timer_mode = UTHREAD_TIMER_WALL;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+
+    slices short_slices = {0, 0}, long_slices = {0, 0};
+    int short_tid = uthread_spawn_arg(spin, &short_slices);
+    int long_tid = uthread_spawn_arg(spin, &long_slices);
+    if (short_tid == -1 || long_tid == -1)
+        fprintf(stderr, "unjustified failure to spawn\n");
+    if (uthread_set_quantum(short_tid, SHORT_QUANTUM) == -1 || uthread_set_quantum(long_tid, LONG_QUANTUM) == -1)
+        fprintf(stderr, "unjustified failure to set a quantum\n");
+    uthread_join(short_tid, NULL);
+    uthread_join(long_tid, NULL);
+
+    printf("short thread preempted %ld times\n", short_slices.preemptions);
+    printf("long thread preempted %ld times\n", long_slices.preemptions);
+    printf("long slices at least twice as long: %s\n",
+           long_slices.average_usecs >= 2 * short_slices.average_usecs ? "yes" : "no");
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
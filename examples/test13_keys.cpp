@@ -0,0 +1,110 @@
+/*
+ * test13.cc - Thread-specific data: every thread sees its own value for a key, and the key destructors run when a
+ * thread returns, terminates itself or is terminated by another thread, again when a destructor sets a new value.
+ * Runs on a single worker without preemption (UTHREAD_TIMER_NONE), so the order of the lines is fixed.
+ *
+ * Output should be:
+ * test13:
+ * --------------
+ * thread 1 sees 1
+ * thread 1 returns
+ * destructor: 1
+ * thread 1 terminates itself
+ * destructor: 2
+ * thread 1 sets a value again in its destructor
+ * destructor: 3
+ * destructor: 4
+ * thread 1 is terminated by main
+ * destructor: 5
+ * main still sees 0
+ *
+ */
+
+#include <stdio.h>
+#include "uthreads.h"
+
+uthread_key_t key, again_key;
+long values[6] = {0, 1, 2, 3, 4, 5};
+
+void print_value(void* value)
+{
+    printf("destructor: %ld\n", *(long*)value);
+}
+
+/* Sets a value for key itself, for one more round of destructors. */
+void set_again(void* value)
+{
+    printf("destructor: %ld\n", *(long*)value);
+    uthread_setspecific(key, &values[4]);
+}
+
+void* returner(void* arg)
+{
+    uthread_setspecific(key, &values[1]);
+    printf("thread %d sees %ld\n", uthread_get_tid(), *(long*)uthread_getspecific(key));
+    printf("thread %d returns\n", uthread_get_tid());
+    return arg;
+}
+
+void* quitter(void* arg)
+{
+    uthread_setspecific(key, &values[2]);
+    printf("thread %d terminates itself\n", uthread_get_tid());
+    uthread_terminate(uthread_get_tid());
+    return arg;
+}
+
+void* resetter(void* arg)
+{
+    uthread_setspecific(again_key, &values[3]);
+    printf("thread %d sets a value again in its destructor\n", uthread_get_tid());
+    return arg;
+}
+
+void* victim(void* arg)
+{
+    uthread_setspecific(key, &values[5]);
+    printf("thread %d is terminated by main\n", uthread_get_tid());
+    uthread_yield();
+    return arg;
+}
+
+void run(thread_start_routine routine)
+{
+    int tid = uthread_spawn_arg(routine, NULL);
+    if (tid == -1)
+        fprintf(stderr, "unjustified failure to spawn\n");
+    uthread_join(tid, NULL);
+}
+
+int main(void)
+{
+    printf("test13:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+    if (uthread_key_create(&key, print_value) == -1 || uthread_key_create(&again_key, set_again) == -1) {
+        fprintf(stderr, "unjustified failure to create a key\n");
+        return 1;
+    }
+    uthread_setspecific(key, &values[0]);
+
+    run(returner);
+    run(quitter);
+    /* The value set_again sets is destroyed in the next round */
+    run(resetter);
+
+    int tid = uthread_spawn_arg(victim, NULL);
+    uthread_yield();
+    if (uthread_terminate(tid) == -1 || uthread_join(tid, NULL) == -1)
+        fprintf(stderr, "unjustified failure to terminate\n");
+
+    printf("main still sees %ld\n", *(long*)uthread_getspecific(key));
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
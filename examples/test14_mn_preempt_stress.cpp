@@ -0,0 +1,64 @@
+/*
+ * test14.cc - M:N preemption stress: four workers with a 50 us wall-clock quantum each (UTHREAD_TIMER_WALL), and
+ * eight threads that lock and unlock a shared mutex in a tight loop, so that ticks keep landing right as threads
+ * enter and leave the library and threads keep moving between workers. Every increment is made under the mutex, so
+ * the total is exact; a preemption that lands at the wrong moment shows up as a hang or a wrong total.
+ *
+ * Output should be:
+ * test14:
+ * --------------
+ * threads: 8
+ * total: 160000
+ *
+ */
+
+#include <stdio.h>
+#include "uthreads.h"
+
+#define NUM_WORKERS 4
+#define NUM_THREADS 8
+#define ITERATIONS 20000
+
+uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+long total = 0;
+
+void* hammer(void* arg)
+{
+    for (int i = 0; i < ITERATIONS; i++) {
+        uthread_mutex_lock(&mutex);
+        total++;
+        uthread_mutex_unlock(&mutex);
+    }
+    return arg;
+}
+
+int main(void)
+{
+    printf("test14:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 50);
+    attr.num_workers = NUM_WORKERS;
+    attr.timer_mode = UTHREAD_TIMER_WALL;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+
+    int tids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        tids[i] = uthread_spawn_arg(hammer, NULL);
+        if (tids[i] == -1)
+            fprintf(stderr, "unjustified failure to spawn\n");
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (uthread_join(tids[i], NULL) == -1)
+            fprintf(stderr, "unjustified failure to join\n");
+    }
+    uthread_mutex_lock(&mutex);
+    printf("threads: %d\n", NUM_THREADS);
+    printf("total: %ld\n", total);
+    uthread_mutex_unlock(&mutex);
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
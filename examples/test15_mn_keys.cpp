@@ -0,0 +1,81 @@
+/*
+ * test15.cc - Thread-specific data under M:N preemption: four workers with a 50 us wall-clock quantum each
+ * (UTHREAD_TIMER_WALL), and eight threads that keep reading back their own value for a key while they are preempted
+ * and moved between workers. Half of them return and half terminate themselves, and the key destructor runs once for
+ * each, with the value the thread set.
+ *
+ * Output should be:
+ * test15:
+ * --------------
+ * threads: 8
+ * wrong values: 0
+ * destructors: 8
+ *
+ */
+
+#include <stdio.h>
+#include "uthreads.h"
+
+#define NUM_WORKERS 4
+#define NUM_THREADS 8
+#define ITERATIONS 200000
+
+uthread_key_t key;
+long values[NUM_THREADS];
+int wrong_values = 0;
+int destructors = 0;
+
+void count_destructor(void* value)
+{
+    if (value < (void*)values || value >= (void*)(values + NUM_THREADS))
+        __atomic_fetch_add(&wrong_values, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&destructors, 1, __ATOMIC_RELAXED);
+}
+
+void* reader(void* arg)
+{
+    long* value = (long*)arg;
+    uthread_setspecific(key, value);
+    for (int i = 0; i < ITERATIONS; i++) {
+        if (uthread_getspecific(key) != value)
+            __atomic_fetch_add(&wrong_values, 1, __ATOMIC_RELAXED);
+    }
+    if (*value % 2)
+        uthread_terminate(uthread_get_tid());
+    return arg;
+}
+
+int main(void)
+{
+    printf("test15:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 50);
+    attr.num_workers = NUM_WORKERS;
+    attr.timer_mode = UTHREAD_TIMER_WALL;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+    if (uthread_key_create(&key, count_destructor) == -1) {
+        fprintf(stderr, "unjustified failure to create a key\n");
+        return 1;
+    }
+
+    int tids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        values[i] = i;
+        tids[i] = uthread_spawn_arg(reader, &values[i]);
+        if (tids[i] == -1)
+            fprintf(stderr, "unjustified failure to spawn\n");
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (uthread_join(tids[i], NULL) == -1)
+            fprintf(stderr, "unjustified failure to join\n");
+    }
+    printf("threads: %d\n", NUM_THREADS);
+    printf("wrong values: %d\n", __atomic_load_n(&wrong_values, __ATOMIC_RELAXED));
+    printf("destructors: %d\n", __atomic_load_n(&destructors, __ATOMIC_RELAXED));
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
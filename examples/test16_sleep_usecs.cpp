@@ -0,0 +1,81 @@
+/*
+ * test16.cc - uthread_sleep_usecs: three threads sleep for 30, 10 and 20 ms, spawned in that order, and wake in the
+ * order of their deadlines, each no earlier than it asked for. A fourth thread keeps yielding for the first 15 ms, so
+ * the first sleeper is woken by a yield and the others by the worker waiting idle. Runs on a single worker without preemption
+ * (UTHREAD_TIMER_NONE), so the order of the lines is fixed.
+ *
+ * Output should be:
+ * test16:
+ * --------------
+ * woke after 10 ms, on time: yes
+ * woke after 20 ms, on time: yes
+ * woke after 30 ms, on time: yes
+ * yielder ran while they slept: yes
+ *
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "uthreads.h"
+
+#define MSEC 1000
+
+long long now_usecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void* sleeper(void* arg)
+{
+    long usecs = (long)arg;
+    long long start = now_usecs();
+    if (uthread_sleep_usecs((int)usecs) == -1)
+        fprintf(stderr, "unjustified failure to sleep\n");
+    printf("woke after %ld ms, on time: %s\n", usecs / MSEC, now_usecs() - start >= usecs ? "yes" : "no");
+    return arg;
+}
+
+/* Yields for 15 ms and returns the number of yields. */
+void* yielder(void* arg)
+{
+    long yields = 0;
+    long long stop = now_usecs() + 15 * MSEC;
+    while (now_usecs() < stop) {
+        uthread_yield();
+        yields++;
+    }
+    (void)arg;
+    return (void*)yields;
+}
+
+int main(void)
+{
+    printf("test16:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+
+    long durations[] = {30 * MSEC, 10 * MSEC, 20 * MSEC};
+    int tids[3];
+    for (int i = 0; i < 3; i++) {
+        tids[i] = uthread_spawn_arg(sleeper, (void*)durations[i]);
+        if (tids[i] == -1)
+            fprintf(stderr, "unjustified failure to spawn\n");
+    }
+    int yielder_tid = uthread_spawn_arg(yielder, NULL);
+    void* yields = NULL;
+    uthread_join(yielder_tid, &yields);
+    for (int i = 0; i < 3; i++) {
+        uthread_join(tids[i], NULL);
+    }
+    printf("yielder ran while they slept: %s\n", (long)yields > 0 ? "yes" : "no");
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
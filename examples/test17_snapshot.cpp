@@ -0,0 +1,146 @@
+/*
+ * test17.cc - uthread_get_state and uthread_snapshot read from a kernel thread the library does not know. The main
+ * thread holds a mutex and spawns threads that block themselves, sleep, wait for the mutex and return, then one that
+ * has not run yet; a pthread snapshots the table and checks each entry against uthread_get_state. A second pthread
+ * then keeps taking snapshots while the main thread resumes, wakes, terminates and joins them all, and checks that
+ * every entry it saw was well formed. Runs on a single worker without preemption (UTHREAD_TIMER_NONE), so the first
+ * snapshot is fixed.
+ *
+ * Output should be:
+ * test17:
+ * --------------
+ * tid 0: RUNNING
+ * tid 1: BLOCKED
+ * tid 2: SLEEPING, time left: yes
+ * tid 3: WAITING
+ * tid 4: TERMINATED
+ * tid 5: READY
+ * uthread_get_state agrees: yes
+ * bad entries while they ran: 0
+ * threads left: 1
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include "uthreads.h"
+
+#define NUM_THREADS 6
+#define SLEEP_USECS 1000000
+
+const char* state_names[] = {"RUNNING", "READY", "BLOCKED", "SLEEPING", "WAITING", "TERMINATED"};
+
+uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+int done = 0;
+long bad_entries = 0;
+
+void* blocker(void* arg)
+{
+    uthread_block(uthread_get_tid());
+    return arg;
+}
+
+void* sleeper(void* arg)
+{
+    uthread_sleep_usecs(SLEEP_USECS);
+    return arg;
+}
+
+void* waiter(void* arg)
+{
+    uthread_mutex_lock(&mutex);
+    uthread_mutex_unlock(&mutex);
+    return arg;
+}
+
+void* quitter(void* arg)
+{
+    return arg;
+}
+
+/* Prints one snapshot of the table and compares it with uthread_get_state. */
+void* print_snapshot(void* arg)
+{
+    uthread_snapshot_t entries[NUM_THREADS];
+    int count = uthread_snapshot(entries, NUM_THREADS);
+    int agrees = count == NUM_THREADS;
+    for (int i = 0; i < count; i++) {
+        printf("tid %d: %s", entries[i].tid, state_names[entries[i].state]);
+        if (entries[i].state == UTHREAD_STATE_SLEEPING)
+            printf(", time left: %s", entries[i].sleep_usecs > 0 && entries[i].sleep_usecs <= SLEEP_USECS ? "yes" : "no");
+        printf("\n");
+        agrees = agrees && uthread_get_state(entries[i].tid) == entries[i].state;
+    }
+    printf("uthread_get_state agrees: %s\n", agrees ? "yes" : "no");
+    return arg;
+}
+
+/* Takes snapshots until done is set, counting entries out of tid order or with an unknown state. */
+void* watch(void* arg)
+{
+    uthread_snapshot_t entries[NUM_THREADS];
+    do {
+        int count = uthread_snapshot(entries, NUM_THREADS);
+        for (int i = 0; i < count; i++) {
+            if ((i > 0 && entries[i].tid <= entries[i - 1].tid) || entries[i].state < UTHREAD_STATE_RUNNING ||
+                entries[i].state > UTHREAD_STATE_TERMINATED)
+                bad_entries++;
+        }
+    } while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE));
+    return arg;
+}
+
+void run_pthread(void* (*routine)(void*), pthread_t* thread)
+{
+    if (pthread_create(thread, NULL, routine, NULL) != 0)
+        fprintf(stderr, "unjustified failure to create a pthread\n");
+}
+
+int main(void)
+{
+    printf("test17:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+
+    uthread_mutex_lock(&mutex);
+    thread_start_routine routines[] = {blocker, sleeper, waiter, quitter, quitter};
+    int tids[NUM_THREADS - 1];
+    for (int i = 0; i < NUM_THREADS - 2; i++) {
+        tids[i] = uthread_spawn_arg(routines[i], NULL);
+    }
+    /* The first four run up to where they stop; the last one is spawned after, and stays READY */
+    uthread_yield();
+    tids[NUM_THREADS - 2] = uthread_spawn_arg(routines[NUM_THREADS - 2], NULL);
+    for (int i = 0; i < NUM_THREADS - 1; i++) {
+        if (tids[i] == -1)
+            fprintf(stderr, "unjustified failure to spawn\n");
+    }
+
+    pthread_t thread;
+    run_pthread(print_snapshot, &thread);
+    pthread_join(thread, NULL);
+    fflush(stdout);
+
+    run_pthread(watch, &thread);
+    uthread_resume(tids[0]);
+    uthread_mutex_unlock(&mutex);
+    uthread_terminate(tids[1]);
+    for (int i = 0; i < NUM_THREADS - 1; i++) {
+        if (uthread_join(tids[i], NULL) == -1)
+            fprintf(stderr, "unjustified failure to join\n");
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    printf("bad entries while they ran: %ld\n", bad_entries);
+
+    uthread_snapshot_t entries[NUM_THREADS];
+    printf("threads left: %d\n", uthread_snapshot(entries, NUM_THREADS));
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
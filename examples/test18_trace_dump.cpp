@@ -0,0 +1,212 @@
+/*
+ * test18.cc - uthread_trace_dump: with the event ring enabled (trace_events), the main thread joins two threads that
+ * yield to each other twice and return, then dumps the trace to a temporary file. The dump is parsed back: it must be
+ * well formed JSON, and its events are counted by name. Runs on a single worker without preemption
+ * (UTHREAD_TIMER_NONE), so the schedule, and with it the trace, is fixed: the trace starts at the main thread's first
+ * switch, each yield and each return ends a slice, the first return wakes the main thread, and the dump closes with
+ * the slice of the main thread still running.
+ *
+ * Output should be:
+ * test18:
+ * --------------
+ * well formed: yes
+ * events: 8
+ * yield: 4
+ * terminate: 2
+ * running: 1
+ * wake: 1
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define YIELDS 2
+#define TRACE_EVENTS 256
+
+const char* names[] = {"preempt", "yield", "block", "sleep", "wait", "terminate", "running", "wake"};
+#define NUM_NAMES (int)(sizeof(names) / sizeof(names[0]))
+
+/* Recursive descent JSON check, counting the objects in the traceEvents array by their "name" */
+const char* pos;
+int events = 0;
+int name_counts[NUM_NAMES];
+
+bool parse_value(int depth);
+
+void skip_space()
+{
+    while (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')
+        pos++;
+}
+
+bool parse_string(char* out, size_t size)
+{
+    if (*pos != '"')
+        return false;
+    size_t len = 0;
+    for (pos++; *pos != '"'; pos++) {
+        if (*pos == '\0' || (unsigned char)*pos < 0x20)
+            return false;
+        if (*pos == '\\' && *++pos == '\0')
+            return false;
+        if (out && len + 1 < size)
+            out[len++] = *pos;
+    }
+    if (out)
+        out[len] = '\0';
+    pos++;
+    return true;
+}
+
+bool parse_number()
+{
+    char* end;
+    strtod(pos, &end);
+    if (end == pos)
+        return false;
+    pos = end;
+    return true;
+}
+
+bool parse_object(int depth)
+{
+    bool is_event = depth == 2;
+    pos++;
+    skip_space();
+    if (*pos == '}') {
+        pos++;
+        return true;
+    }
+    while (true) {
+        char key[32];
+        skip_space();
+        if (!parse_string(key, sizeof(key)))
+            return false;
+        skip_space();
+        if (*pos++ != ':')
+            return false;
+        skip_space();
+        if (is_event && strcmp(key, "name") == 0) {
+            char name[32];
+            if (!parse_string(name, sizeof(name)))
+                return false;
+            for (int i = 0; i < NUM_NAMES; i++) {
+                if (strcmp(name, names[i]) == 0)
+                    name_counts[i]++;
+            }
+        } else if (!parse_value(depth + 1)) {
+            return false;
+        }
+        skip_space();
+        if (*pos == '}') {
+            pos++;
+            if (is_event)
+                events++;
+            return true;
+        }
+        if (*pos++ != ',')
+            return false;
+    }
+}
+
+bool parse_array(int depth)
+{
+    pos++;
+    skip_space();
+    if (*pos == ']') {
+        pos++;
+        return true;
+    }
+    while (true) {
+        skip_space();
+        if (!parse_value(depth + 1))
+            return false;
+        skip_space();
+        if (*pos == ']') {
+            pos++;
+            return true;
+        }
+        if (*pos++ != ',')
+            return false;
+    }
+}
+
+bool parse_value(int depth)
+{
+    if (*pos == '{')
+        return parse_object(depth);
+    if (*pos == '[')
+        return parse_array(depth);
+    if (*pos == '"')
+        return parse_string(NULL, 0);
+    if (strncmp(pos, "true", 4) == 0 || strncmp(pos, "null", 4) == 0) {
+        pos += 4;
+        return true;
+    }
+    if (strncmp(pos, "false", 5) == 0) {
+        pos += 5;
+        return true;
+    }
+    return parse_number();
+}
+
+void* yield_and_return(void* arg)
+{
+    for (int i = 0; i < YIELDS; i++) {
+        uthread_yield();
+    }
+    return arg;
+}
+
+int main(void)
+{
+    printf("test18:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    attr.trace_events = TRACE_EVENTS;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+
+    int first = uthread_spawn_arg(yield_and_return, NULL);
+    int second = uthread_spawn_arg(yield_and_return, NULL);
+    if (first == -1 || second == -1)
+        fprintf(stderr, "unjustified failure to spawn\n");
+    uthread_join(first, NULL);
+    uthread_join(second, NULL);
+
+    FILE* file = tmpfile();
+    if (!file || uthread_trace_dump(fileno(file)) == -1) {
+        fprintf(stderr, "unjustified failure to dump the trace\n");
+        return 1;
+    }
+    /* The dump writes to the fd directly, past the FILE buffer */
+    off_t size = lseek(fileno(file), 0, SEEK_CUR);
+    char* json = (char*)calloc(size + 1, 1);
+    if (!json || pread(fileno(file), json, size, 0) != size) {
+        fprintf(stderr, "unjustified failure to read the trace back\n");
+        return 1;
+    }
+
+    pos = json;
+    skip_space();
+    bool well_formed = parse_value(0);
+    skip_space();
+    printf("well formed: %s\n", well_formed && *pos == '\0' ? "yes" : "no");
+    printf("events: %d\n", events);
+    for (int i = 0; i < NUM_NAMES; i++) {
+        if (name_counts[i])
+            printf("%s: %d\n", names[i], name_counts[i]);
+    }
+    free(json);
+    fclose(file);
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
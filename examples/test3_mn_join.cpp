@@ -0,0 +1,70 @@
+/*
+ * test3.cc - M:N scheduling: four workers run sixteen threads, each summing its own part of 1..1600000, and the main
+ * thread joins them in order. Preemption is off (UTHREAD_TIMER_NONE) and only the main thread prints, so the output
+ * does not depend on which worker ran which thread.
+ *
+ * Output should be:
+ * test3:
+ * --------------
+ * workers: 4
+ * thread 1: 5000050000
+ * thread 2: 15000050000
+ * ...
+ * thread 16: 155000050000
+ * total: 1280000800000
+ *
+ */
+
+#include <stdio.h>
+#include "uthreads.h"
+
+#define NUM_WORKERS 4
+#define NUM_THREADS 16
+#define PART 100000
+
+long long sums[NUM_THREADS + 1];
+
+/* Sums part i of the range and returns i. */
+void* sum_part(void* arg)
+{
+    long i = (long)arg;
+    long long sum = 0;
+    for (long k = (i - 1) * PART + 1; k <= i * PART; k++) {
+        sum += k;
+    }
+    sums[i] = sum;
+    return arg;
+}
+
+int main(void)
+{
+    printf("test3:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.num_workers = NUM_WORKERS;
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+    printf("workers: %d\n", attr.num_workers);
+
+    int tids[NUM_THREADS + 1];
+    for (long i = 1; i <= NUM_THREADS; i++) {
+        tids[i] = uthread_spawn_arg(sum_part, (void*)i);
+        if (tids[i] == -1)
+            fprintf(stderr, "unjustified failure to spawn\n");
+    }
+    long long total = 0;
+    for (long i = 1; i <= NUM_THREADS; i++) {
+        void* result = NULL;
+        if (uthread_join(tids[i], &result) == -1 || result != (void*)i)
+            fprintf(stderr, "unjustified failure to join\n");
+        printf("thread %ld: %lld\n", i, sums[i]);
+        total += sums[i];
+    }
+    printf("total: %lld\n", total);
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
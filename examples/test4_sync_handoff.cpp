@@ -0,0 +1,141 @@
+/*
+ * test4.cc - Mutex, condition variable and semaphore handoffs on a single worker without preemption
+ * (UTHREAD_TIMER_NONE), so that threads switch only when they block, and the order of the lines is fixed.
+ *
+ * Output should be:
+ * test4:
+ * --------------
+ * 1 locks the mutex
+ * 2 waits for the mutex
+ * 1 unlocks the mutex
+ * 2 got the mutex
+ * produced 1
+ * consumed 1
+ * ...
+ * produced 3
+ * consumed 3
+ * ping 1
+ * pong 1
+ * ...
+ * ping 3
+ * pong 3
+ * done
+ *
+ */
+
+#include <stdio.h>
+#include "uthreads.h"
+
+#define ITEMS 3
+
+uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+uthread_cond_t changed = UTHREAD_COND_INITIALIZER;
+int slot = 0;  /* one-item buffer guarded by mutex, 0 when empty */
+
+uthread_sem_t ping, pong, finished;
+
+/* Holds the mutex across a yield, so that the other thread has to wait for it. */
+void holder()
+{
+    uthread_mutex_lock(&mutex);
+    printf("%d locks the mutex\n", uthread_get_tid());
+    uthread_yield();
+    printf("%d unlocks the mutex\n", uthread_get_tid());
+    uthread_mutex_unlock(&mutex);
+    uthread_sem_post(&finished);
+    uthread_terminate(uthread_get_tid());
+}
+
+void contender()
+{
+    printf("%d waits for the mutex\n", uthread_get_tid());
+    uthread_mutex_lock(&mutex);
+    printf("%d got the mutex\n", uthread_get_tid());
+    uthread_mutex_unlock(&mutex);
+    uthread_sem_post(&finished);
+    uthread_terminate(uthread_get_tid());
+}
+
+void producer()
+{
+    for (int i = 1; i <= ITEMS; i++) {
+        uthread_mutex_lock(&mutex);
+        while (slot != 0)
+            uthread_cond_wait(&changed, &mutex);
+        slot = i;
+        printf("produced %d\n", i);
+        uthread_cond_signal(&changed);
+        uthread_mutex_unlock(&mutex);
+    }
+    uthread_sem_post(&finished);
+    uthread_terminate(uthread_get_tid());
+}
+
+void consumer()
+{
+    for (int i = 1; i <= ITEMS; i++) {
+        uthread_mutex_lock(&mutex);
+        while (slot == 0)
+            uthread_cond_wait(&changed, &mutex);
+        printf("consumed %d\n", slot);
+        slot = 0;
+        uthread_cond_signal(&changed);
+        uthread_mutex_unlock(&mutex);
+    }
+    uthread_sem_post(&finished);
+    uthread_terminate(uthread_get_tid());
+}
+
+void pinger()
+{
+    for (int i = 1; i <= ITEMS; i++) {
+        printf("ping %d\n", i);
+        uthread_sem_post(&ping);
+        uthread_sem_wait(&pong);
+    }
+    uthread_sem_post(&finished);
+    uthread_terminate(uthread_get_tid());
+}
+
+void ponger()
+{
+    for (int i = 1; i <= ITEMS; i++) {
+        uthread_sem_wait(&ping);
+        printf("pong %d\n", i);
+        uthread_sem_post(&pong);
+    }
+    uthread_sem_post(&finished);
+    uthread_terminate(uthread_get_tid());
+}
+
+/* Spawns two threads and waits until both have posted finished. */
+void run_pair(thread_entry_point first, thread_entry_point second)
+{
+    if (uthread_spawn(first) == -1 || uthread_spawn(second) == -1)
+        fprintf(stderr, "unjustified failure to spawn\n");
+    uthread_sem_wait(&finished);
+    uthread_sem_wait(&finished);
+}
+
+int main(void)
+{
+    printf("test4:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+    uthread_sem_init(&ping, 0);
+    uthread_sem_init(&pong, 0);
+    uthread_sem_init(&finished, 0);
+
+    run_pair(holder, contender);
+    run_pair(producer, consumer);
+    run_pair(pinger, ponger);
+    printf("done\n");
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
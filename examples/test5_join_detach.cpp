@@ -0,0 +1,88 @@
+/*
+ * test5.cc - Joinable threads: results returned from start_routine, joining a thread before and after it finished,
+ * a thread that terminates itself, and a detached thread whose ID is released when it ends (joining releases the ID
+ * too, so every thread here gets ID 1). Runs on a single worker without preemption (UTHREAD_TIMER_NONE), so the
+ * order of the lines is fixed.
+ *
+ * Output should be:
+ * test5:
+ * --------------
+ * square(7) started
+ * join 1: 49
+ * square(9) started
+ * join 1 after it finished: 81
+ * join 1 (terminated itself): null
+ * detached 1 started
+ * detached 1 done
+ * next spawn reuses ID 1: yes
+ *
+ */
+
+#include <stdio.h>
+#include "uthreads.h"
+
+void* square(void* arg)
+{
+    long n = (long)arg;
+    printf("square(%ld) started\n", n);
+    return (void*)(n * n);
+}
+
+void* quitter(void* arg)
+{
+    uthread_terminate(uthread_get_tid());
+    return arg;  /* not reached */
+}
+
+void* background(void* arg)
+{
+    printf("detached %d started\n", uthread_get_tid());
+    uthread_yield();
+    printf("detached %d done\n", uthread_get_tid());
+    return arg;
+}
+
+int main(void)
+{
+    printf("test5:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+    void* result = NULL;
+
+    /* Joined while it has not run yet */
+    int tid = uthread_spawn_arg(square, (void*)7);
+    if (uthread_join(tid, &result) == -1)
+        fprintf(stderr, "unjustified failure to join\n");
+    printf("join %d: %ld\n", tid, (long)result);
+
+    /* Joined after it finished: the result is kept until then */
+    tid = uthread_spawn_arg(square, (void*)9);
+    uthread_yield();
+    if (uthread_join(tid, &result) == -1)
+        fprintf(stderr, "unjustified failure to join\n");
+    printf("join %d after it finished: %ld\n", tid, (long)result);
+
+    tid = uthread_spawn_arg(quitter, (void*)1);
+    if (uthread_join(tid, &result) == -1)
+        fprintf(stderr, "unjustified failure to join\n");
+    printf("join %d (terminated itself): %s\n", tid, result ? "not null" : "null");
+
+    /* A detached thread cannot be joined, and releases its ID when it ends */
+    int detached = uthread_spawn_arg(background, NULL);
+    if (uthread_detach(detached) == -1)
+        fprintf(stderr, "unjustified failure to detach\n");
+    uthread_yield();
+    uthread_yield();
+    tid = uthread_spawn_arg(square, (void*)0);
+    printf("next spawn reuses ID %d: %s\n", detached, tid == detached ? "yes" : "no");
+    uthread_detach(tid);
+
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * test6.cc - Threads parked on a pipe: uthread_wait_fd with and without a timeout, and uthread_read, while the main
+ * thread keeps running. Runs on a single worker without preemption (UTHREAD_TIMER_NONE), so the order of the lines
+ * is fixed.
+ *
+ * Output should be:
+ * test6:
+ * --------------
+ * reader waits
+ * main writes
+ * reader ready: 1
+ * reader got: hello
+ * timeout: 0
+ * blocked read waits
+ * main writes again
+ * blocked read got: world
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+int pipe_fds[2];
+
+void* waiter(void* arg)
+{
+    char buf[16] = {0};
+    printf("reader waits\n");
+    int ready = uthread_wait_fd(pipe_fds[0], UTHREAD_IO_READ, -1);
+    printf("reader ready: %d\n", ready);
+    if (read(pipe_fds[0], buf, sizeof(buf) - 1) < 0)
+        fprintf(stderr, "unjustified failure to read\n");
+    printf("reader got: %s\n", buf);
+
+    /* Nothing left to read: times out after 10 ms */
+    printf("timeout: %d\n", uthread_wait_fd(pipe_fds[0], UTHREAD_IO_READ, 10000));
+    return arg;
+}
+
+void* reader(void* arg)
+{
+    char buf[16] = {0};
+    printf("blocked read waits\n");
+    if (uthread_read(pipe_fds[0], buf, sizeof(buf) - 1) < 0)
+        fprintf(stderr, "unjustified failure to read\n");
+    printf("blocked read got: %s\n", buf);
+    return arg;
+}
+
+/* Runs routine until it parks, then announces and writes text into the pipe and joins it. */
+void run_with_write(thread_start_routine routine, const char* announce, const char* text)
+{
+    int tid = uthread_spawn_arg(routine, NULL);
+    if (tid == -1)
+        fprintf(stderr, "unjustified failure to spawn\n");
+    uthread_yield();
+    printf("%s\n", announce);
+    if (write(pipe_fds[1], text, strlen(text)) < 0)
+        fprintf(stderr, "unjustified failure to write\n");
+    uthread_join(tid, NULL);
+}
+
+int main(void)
+{
+    printf("test6:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+    if (pipe2(pipe_fds, O_NONBLOCK) == -1) {
+        fprintf(stderr, "unjustified failure to create a pipe\n");
+        return 1;
+    }
+
+    run_with_write(waiter, "main writes", "hello");
+    run_with_write(reader, "main writes again", "world");
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
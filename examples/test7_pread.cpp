@@ -0,0 +1,109 @@
+/*
+ * test7.cc - Asynchronous file I/O: four threads each write one record of a temporary file with uthread_pwrite, then
+ * four threads read them back in reverse with uthread_pread, and one read at offset -1 takes data from a pipe. The
+ * threads are parked while their operations are in flight. Runs on a single worker without preemption
+ * (UTHREAD_TIMER_NONE) and only the main thread prints the results, so the output is fixed.
+ *
+ * Output should be:
+ * test7:
+ * --------------
+ * wrote 4 records
+ * record 3: <record 3>
+ * record 2: <record 2>
+ * record 1: <record 1>
+ * record 0: <record 0>
+ * pipe: 5 bytes: hello
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define RECORDS 4
+#define RECORD_SIZE 16
+
+int file_fd;
+char records[RECORDS][RECORD_SIZE + 1];
+
+void* write_record(void* arg)
+{
+    long i = (long)arg;
+    char buf[RECORD_SIZE];
+    memset(buf, ' ', sizeof(buf));
+    memcpy(buf, "<record ", 8);
+    buf[8] = (char)('0' + i);
+    buf[9] = '>';
+    return (void*)uthread_pwrite(file_fd, buf, RECORD_SIZE, i * RECORD_SIZE);
+}
+
+void* read_record(void* arg)
+{
+    long i = (long)arg;
+    return (void*)uthread_pread(file_fd, records[i], RECORD_SIZE, i * RECORD_SIZE);
+}
+
+/* Runs routine(i) for every record on threads of its own, and returns the number of bytes they transferred. */
+long for_each_record(thread_start_routine routine, bool reverse)
+{
+    int tids[RECORDS];
+    for (long k = 0; k < RECORDS; k++) {
+        tids[k] = uthread_spawn_arg(routine, (void*)(reverse ? RECORDS - 1 - k : k));
+        if (tids[k] == -1)
+            fprintf(stderr, "unjustified failure to spawn\n");
+    }
+    long total = 0;
+    for (int k = 0; k < RECORDS; k++) {
+        void* result = NULL;
+        uthread_join(tids[k], &result);
+        total += (long)result;
+    }
+    return total;
+}
+
+int main(void)
+{
+    printf("test7:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+    char path[] = "/tmp/uthreads_test7_XXXXXX";
+    file_fd = mkstemp(path);
+    if (file_fd == -1) {
+        fprintf(stderr, "unjustified failure to create a file\n");
+        return 1;
+    }
+    unlink(path);
+
+    if (for_each_record(write_record, false) != RECORDS * RECORD_SIZE)
+        fprintf(stderr, "unjustified short write\n");
+    printf("wrote %d records\n", RECORDS);
+    if (for_each_record(read_record, true) != RECORDS * RECORD_SIZE)
+        fprintf(stderr, "unjustified short read\n");
+    for (int i = RECORDS - 1; i >= 0; i--) {
+        printf("record %d: %.10s\n", i, records[i]);
+    }
+    close(file_fd);
+
+    /* Offset -1 reads at the current position, which also works on pipes */
+    int pipe_fds[2];
+    char buf[16] = {0};
+    if (pipe(pipe_fds) == -1 || write(pipe_fds[1], "hello", 5) != 5) {
+        fprintf(stderr, "unjustified failure to fill a pipe\n");
+        return 1;
+    }
+    ssize_t n = uthread_pread(pipe_fds[0], buf, sizeof(buf) - 1, -1);
+    printf("pipe: %zd bytes: %s\n", n, buf);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
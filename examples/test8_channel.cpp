@@ -0,0 +1,96 @@
+/*
+ * test8.cc - A channel fed by a kernel thread that is not a library worker (a plain pthread) and by a uthread, and
+ * drained by the main thread, which is parked whenever the channel is empty. Messages of each sender arrive in the
+ * order they were sent. Runs on a single worker without preemption (UTHREAD_TIMER_NONE) and only the main thread
+ * prints, so the output is fixed.
+ *
+ * Output should be:
+ * test8:
+ * --------------
+ * received 2000 messages
+ * pthread messages: 1000, sum 500500, in order: yes
+ * uthread messages: 1000, sum 1500500, in order: yes
+ *
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include "uthreads.h"
+
+#define MESSAGES 1000
+
+uthread_chan_t* chan;
+
+/* Sends 1 .. MESSAGES, one at a time, from outside the library. */
+void* foreign_sender(void* arg)
+{
+    for (long i = 1; i <= MESSAGES; i++) {
+        while (uthread_chan_send(chan, (void*)i) == 1) {}
+    }
+    return arg;
+}
+
+/* Sends MESSAGES + 1 .. 2 * MESSAGES in batches. */
+void* uthread_sender(void* arg)
+{
+    void* batch[10];
+    for (long i = MESSAGES + 1; i <= 2 * MESSAGES; i += 10) {
+        for (int k = 0; k < 10; k++) {
+            batch[k] = (void*)(i + k);
+        }
+        uthread_chan_send_batch(chan, batch, 10);
+        uthread_yield();
+    }
+    return arg;
+}
+
+int main(void)
+{
+    printf("test8:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+    chan = uthread_chan_create(0);
+    if (!chan) {
+        fprintf(stderr, "unjustified failure to create a channel\n");
+        return 1;
+    }
+    pthread_t foreign;
+    if (pthread_create(&foreign, NULL, foreign_sender, NULL) != 0) {
+        fprintf(stderr, "unjustified failure to create a pthread\n");
+        return 1;
+    }
+    int tid = uthread_spawn_arg(uthread_sender, NULL);
+    if (tid == -1)
+        fprintf(stderr, "unjustified failure to spawn\n");
+
+    long count[2] = {0, 0}, sum[2] = {0, 0}, last[2] = {0, MESSAGES};
+    bool in_order[2] = {true, true};
+    for (int n = 0; n < 2 * MESSAGES; n++) {
+        void* msg;
+        if (uthread_chan_recv(chan, &msg) == -1) {
+            fprintf(stderr, "unjustified failure to receive\n");
+            break;
+        }
+        long value = (long)msg;
+        int sender = value > MESSAGES;
+        in_order[sender] = in_order[sender] && value == last[sender] + 1;
+        last[sender] = value;
+        count[sender]++;
+        sum[sender] += value;
+    }
+    pthread_join(foreign, NULL);
+    uthread_join(tid, NULL);
+    uthread_chan_destroy(chan);
+
+    printf("received %ld messages\n", count[0] + count[1]);
+    printf("pthread messages: %ld, sum %ld, in order: %s\n", count[0], sum[0], in_order[0] ? "yes" : "no");
+    printf("uthread messages: %ld, sum %ld, in order: %s\n", count[1], sum[1], in_order[1] ? "yes" : "no");
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * test9.cc - Fork-join: uthread_parallel_for sums the squares of 0..999999 in chunks, each chunk into its own slot,
+ * and a task group computes ten Fibonacci numbers. Runs on two workers without preemption (UTHREAD_TIMER_NONE); only
+ * the main thread prints, after waiting, so the output does not depend on where the chunks ran.
+ *
+ * Output should be:
+ * test9:
+ * --------------
+ * chunks: 100
+ * sum of squares: 333332833333500000
+ * fib(20) .. fib(29): 6765 10946 17711 28657 46368 75025 121393 196418 317811 514229
+ *
+ */
+
+#include <stdio.h>
+#include "uthreads.h"
+
+#define N 1000000
+#define GRAIN 10000
+#define CHUNKS (N / GRAIN)
+#define TASKS 10
+
+unsigned long long partial[CHUNKS];
+int chunks_run[CHUNKS];
+
+void sum_squares(long begin, long end, void* ctx)
+{
+    unsigned long long sum = 0;
+    for (long i = begin; i < end; i++) {
+        sum += (unsigned long long)i * i;
+    }
+    partial[begin / GRAIN] = sum;
+    __atomic_add_fetch(&chunks_run[begin / GRAIN], 1, __ATOMIC_RELAXED);
+    (void)ctx;
+}
+
+long fib(int n)
+{
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+long fibs[TASKS];
+
+void fib_task(void* arg)
+{
+    long i = (long)arg;
+    fibs[i] = fib(20 + (int)i);
+}
+
+int main(void)
+{
+    printf("test9:\n--------------\n");
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, 1000);
+    attr.num_workers = 2;
+    attr.timer_mode = UTHREAD_TIMER_NONE;
+    if (uthread_init_ex(&attr) == -1) {
+        fprintf(stderr, "unjustified failure to init\n");
+        return 1;
+    }
+
+    if (uthread_parallel_for(0, N, GRAIN, sum_squares, NULL) == -1)
+        fprintf(stderr, "unjustified failure of parallel_for\n");
+    int chunks = 0;
+    unsigned long long total = 0;
+    for (int c = 0; c < CHUNKS; c++) {
+        if (chunks_run[c] != 1)
+            fprintf(stderr, "chunk %d ran %d times\n", c, chunks_run[c]);
+        chunks += chunks_run[c];
+        total += partial[c];
+    }
+    printf("chunks: %d\n", chunks);
+    printf("sum of squares: %llu\n", total);
+
+    uthread_taskgroup_t* group = uthread_taskgroup_create();
+    for (long i = 0; i < TASKS; i++) {
+        if (uthread_taskgroup_spawn(group, fib_task, (void*)i) == -1)
+            fprintf(stderr, "unjustified failure to spawn a task\n");
+    }
+    if (uthread_taskgroup_wait(group) == -1)
+        fprintf(stderr, "unjustified failure to wait for the group\n");
+    uthread_taskgroup_destroy(group);
+    printf("fib(20) .. fib(29):");
+    for (int i = 0; i < TASKS; i++) {
+        printf(" %ld", fibs[i]);
+    }
+    printf("\n");
+
+    fflush(stdout);
+    uthread_terminate(0);
+    return 0;
+}
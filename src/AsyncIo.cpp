@@ -0,0 +1,344 @@
+#include "AsyncIo.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uthreads.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define UTHREADS_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#define RING_ENTRIES 256
+#define SQPOLL_IDLE_MSECS 1000 /* idle time before the SQPOLL kernel thread goes to sleep */
+
+AsyncIo::AsyncIo() :
+        backend(-1),
+        inflight(0),
+        ring_fd(-1),
+        unsubmitted(0),
+        cq_capacity(0),
+        sq_ring(nullptr),
+        sq_ring_size(0),
+        cq_ring(nullptr),
+        cq_ring_size(0),
+        sqes(nullptr),
+        sqes_size(0),
+        sq_head(nullptr),
+        sq_tail(nullptr),
+        sq_mask(nullptr),
+        sq_entries(nullptr),
+        sq_flags(nullptr),
+        sq_array(nullptr),
+        cq_head(nullptr),
+        cq_tail(nullptr),
+        cq_mask(nullptr),
+        cqes(nullptr),
+        event_fd(-1),
+        queue_head(nullptr),
+        queue_tail(nullptr),
+        done(nullptr),
+        num_helpers(0)
+{
+    pthread_mutex_init(&lock, nullptr);
+    pthread_cond_init(&work, nullptr);
+}
+
+AsyncIo::~AsyncIo() {
+    // Helper threads are left to the process exit: they may be blocked in a
+    // system call on behalf of a request.
+    if (cq_ring && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring) {
+        munmap(sq_ring, sq_ring_size);
+    }
+    if (sqes) {
+        munmap(sqes, sqes_size);
+    }
+    if (ring_fd >= 0) {
+        close(ring_fd);
+    }
+}
+
+bool AsyncIo::initialized() const {
+    return backend >= 0;
+}
+
+int AsyncIo::notify_fd() const {
+    return ring_fd >= 0 ? ring_fd : event_fd;
+}
+
+size_t AsyncIo::in_flight() const {
+    return inflight;
+}
+
+bool AsyncIo::init(int mode) {
+    if (mode != UTHREAD_AIO_THREADS && init_uring(mode == UTHREAD_AIO_SQPOLL)) {
+        backend = mode;
+        return true;
+    }
+    // SQPOLL needs privileges on older kernels: retry without it first
+    if (mode == UTHREAD_AIO_SQPOLL && init_uring(false)) {
+        backend = UTHREAD_AIO_URING;
+        return true;
+    }
+    if (init_threads()) {
+        backend = UTHREAD_AIO_THREADS;
+        return true;
+    }
+    return false;
+}
+
+#ifdef UTHREADS_HAVE_IO_URING
+
+template <typename T>
+static T* ring_field(void* ring, unsigned offset) {
+    return (T*)((char*)ring + offset);
+}
+
+bool AsyncIo::init_uring(bool sqpoll) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (sqpoll) {
+        p.flags = IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = SQPOLL_IDLE_MSECS;
+    }
+    int fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (fd < 0) {
+        return false;
+    }
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && cq_size > sq_size) {
+        sq_size = cq_size;
+    }
+    void* sq = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    void* cq = sq;
+    if (sq != MAP_FAILED && !single_mmap) {
+        cq = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    size_t entries_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* entries = MAP_FAILED;
+    if (sq != MAP_FAILED && cq != MAP_FAILED) {
+        entries = mmap(nullptr, entries_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_SQES);
+    }
+    if (entries == MAP_FAILED) {
+        if (cq != MAP_FAILED && cq != sq) {
+            munmap(cq, cq_size);
+        }
+        if (sq != MAP_FAILED) {
+            munmap(sq, sq_size);
+        }
+        close(fd);
+        return false;
+    }
+    ring_fd = fd;
+    sq_ring = sq;
+    sq_ring_size = sq_size;
+    cq_ring = cq;
+    cq_ring_size = cq_size;
+    sqes = entries;
+    sqes_size = entries_size;
+    sq_head = ring_field<unsigned>(sq, p.sq_off.head);
+    sq_tail = ring_field<unsigned>(sq, p.sq_off.tail);
+    sq_mask = ring_field<unsigned>(sq, p.sq_off.ring_mask);
+    sq_entries = ring_field<unsigned>(sq, p.sq_off.ring_entries);
+    sq_flags = ring_field<unsigned>(sq, p.sq_off.flags);
+    sq_array = ring_field<unsigned>(sq, p.sq_off.array);
+    cq_head = ring_field<unsigned>(cq, p.cq_off.head);
+    cq_tail = ring_field<unsigned>(cq, p.cq_off.tail);
+    cq_mask = ring_field<unsigned>(cq, p.cq_off.ring_mask);
+    cqes = ring_field<void>(cq, p.cq_off.cqes);
+    cq_capacity = p.cq_entries;
+    return true;
+}
+
+static bool uring_submission_full(unsigned* head, unsigned* tail, unsigned* entries) {
+    return *tail - __atomic_load_n(head, __ATOMIC_ACQUIRE) == *entries;
+}
+
+static void uring_submit(AioRequest* req, void* sqes, unsigned* tail, unsigned* mask, unsigned* array) {
+    unsigned index = *tail & *mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = req->fd;
+    sqe->addr = (uint64_t)(uintptr_t)req->buf;
+    // Larger counts complete short, which read(2) and write(2) allow anyway
+    sqe->len = req->count > UINT32_MAX ? UINT32_MAX : (uint32_t)req->count;
+    sqe->off = (uint64_t)req->offset;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    array[index] = index;
+    __atomic_store_n(tail, *tail + 1, __ATOMIC_RELEASE);
+}
+
+#else
+
+bool AsyncIo::init_uring(bool sqpoll) {
+    (void)sqpoll;
+    return false;
+}
+
+#endif
+
+bool AsyncIo::submit(AioRequest* req) {
+    if (backend == UTHREAD_AIO_THREADS) {
+        req->next = nullptr;
+        pthread_mutex_lock(&lock);
+        if (queue_tail) {
+            queue_tail->next = req;
+        } else {
+            queue_head = req;
+        }
+        queue_tail = req;
+        pthread_cond_signal(&work);
+        pthread_mutex_unlock(&lock);
+        inflight++;
+        return true;
+    }
+#ifdef UTHREADS_HAVE_IO_URING
+    // Never let completions outnumber the completion queue
+    if (inflight >= cq_capacity) {
+        return false;
+    }
+    if (uring_submission_full(sq_head, sq_tail, sq_entries) &&
+        (!flush() || uring_submission_full(sq_head, sq_tail, sq_entries))) {
+        return false;
+    }
+    uring_submit(req, sqes, sq_tail, sq_mask, sq_array);
+    unsubmitted++;
+    inflight++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool AsyncIo::flush() {
+#ifdef UTHREADS_HAVE_IO_URING
+    if (ring_fd < 0 || unsubmitted == 0) {
+        return true;
+    }
+    if (backend == UTHREAD_AIO_SQPOLL) {
+        // The kernel thread picks the entries up by itself unless it fell asleep
+        unsubmitted = 0;
+        if (__atomic_load_n(sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) {
+            return syscall(__NR_io_uring_enter, ring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP, nullptr, 0) >= 0;
+        }
+        return true;
+    }
+    while (unsubmitted > 0) {
+        long n = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 0, 0, nullptr, 0);
+        if (n < 0) {
+            // Out of resources for now: the entries stay queued for the next flush
+            return errno == EAGAIN || errno == EBUSY || errno == EINTR;
+        }
+        unsubmitted -= (unsigned)n;
+    }
+#endif
+    return true;
+}
+
+int AsyncIo::reap(void (*complete)(AioRequest*)) {
+    int count = 0;
+    if (backend == UTHREAD_AIO_THREADS) {
+        uint64_t value;
+        if (read(event_fd, &value, sizeof(value)) < 0 && errno == EAGAIN) {
+            return 0;
+        }
+        pthread_mutex_lock(&lock);
+        AioRequest* list = done;
+        done = nullptr;
+        pthread_mutex_unlock(&lock);
+        while (list) {
+            AioRequest* req = list;
+            list = list->next;
+            inflight--;
+            count++;
+            complete(req);
+        }
+        return count;
+    }
+#ifdef UTHREADS_HAVE_IO_URING
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = (struct io_uring_cqe*)cqes + (head & *cq_mask);
+        AioRequest* req = (AioRequest*)(uintptr_t)cqe->user_data;
+        req->result = cqe->res;
+        head++;
+        inflight--;
+        count++;
+        complete(req);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+#endif
+    return count;
+}
+
+bool AsyncIo::init_threads() {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        return false;
+    }
+    // The helpers must never take the preemption signal of the workers
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (int i = 0; i < AIO_HELPER_THREADS; i++) {
+        if (pthread_create(&helpers[i], nullptr, helper_main, this) != 0) {
+            break;
+        }
+        pthread_detach(helpers[i]);
+        num_helpers++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    return num_helpers > 0;
+}
+
+void* AsyncIo::helper_main(void* arg) {
+    AsyncIo* aio = (AsyncIo*)arg;
+    while (true) {
+        pthread_mutex_lock(&aio->lock);
+        while (!aio->queue_head) {
+            pthread_cond_wait(&aio->work, &aio->lock);
+        }
+        AioRequest* req = aio->queue_head;
+        aio->queue_head = req->next;
+        if (!aio->queue_head) {
+            aio->queue_tail = nullptr;
+        }
+        pthread_mutex_unlock(&aio->lock);
+
+        // Offset -1 uses the file position, as io_uring does, so that sockets and pipes work too
+        ssize_t n;
+        if (req->offset == -1) {
+            n = req->write ? write(req->fd, req->buf, req->count) : read(req->fd, req->buf, req->count);
+        } else {
+            n = req->write ? pwrite(req->fd, req->buf, req->count, req->offset)
+                           : pread(req->fd, req->buf, req->count, req->offset);
+        }
+        req->result = n < 0 ? -errno : n;
+
+        pthread_mutex_lock(&aio->lock);
+        req->next = aio->done;
+        aio->done = req;
+        pthread_mutex_unlock(&aio->lock);
+        uint64_t one = 1;
+        ssize_t unused = write(aio->event_fd, &one, sizeof(one));
+        (void)unused;
+    }
+    return nullptr;
+}
@@ -0,0 +1,108 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define AIO_HELPER_THREADS 4 /* kernel threads of the UTHREAD_AIO_THREADS backend */
+
+class Thread;
+
+/**
+ * @brief One read or write submitted by a parked thread. It lives on that
+ * thread's stack until the operation completes.
+ */
+struct AioRequest {
+    Thread* thread;
+    bool write;
+    int fd;
+    void* buf;
+    size_t count;
+    off_t offset;
+    ssize_t result;     // bytes transferred, or -errno
+    AioRequest* next;   // link in the thread pool backend's queues
+};
+
+/**
+ * @brief Completion-based file I/O for parked threads.
+ *
+ * The io_uring backends (UTHREAD_AIO_URING, and UTHREAD_AIO_SQPOLL with a
+ * kernel thread polling the submission queue) talk to the kernel through the
+ * shared rings directly: submissions are only written to the ring until flush,
+ * so many of them go to the kernel in one io_uring_enter (or none at all with
+ * SQPOLL), and reaping completions costs no system call. Where io_uring is not
+ * available, UTHREAD_AIO_THREADS runs the operations as blocking pread/pwrite
+ * calls on a few helper kernel threads.
+ *
+ * Either way notify_fd becomes readable while completions wait to be reaped,
+ * so it can be watched together with other file descriptors.
+ */
+class AsyncIo {
+public:
+    AsyncIo();
+    ~AsyncIo();
+
+    // Sets up the given UTHREAD_AIO_* backend, falling back to the helper
+    // threads if io_uring cannot be used. Returns false on failure.
+    bool init(int backend);
+
+    bool initialized() const;
+    int notify_fd() const;
+
+    // Operations submitted and not reaped yet
+    size_t in_flight() const;
+
+    // Queues req, flushing first if the submission queue is full. Returns
+    // false if the operation cannot be queued right now (too many in flight).
+    bool submit(AioRequest* req);
+
+    // Hands every queued submission to the kernel, returns false on failure
+    bool flush();
+
+    // Passes every completed request, with its result set, to complete.
+    // Returns the number of requests completed.
+    int reap(void (*complete)(AioRequest*));
+
+private:
+    int backend;
+    size_t inflight;
+
+    // io_uring
+    int ring_fd;
+    unsigned unsubmitted;
+    unsigned cq_capacity;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    void* sqes;
+    size_t sqes_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_entries;
+    unsigned* sq_flags;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    void* cqes;
+
+    // helper threads
+    int event_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    AioRequest* queue_head;
+    AioRequest* queue_tail;
+    AioRequest* done;
+    pthread_t helpers[AIO_HELPER_THREADS];
+    int num_helpers;
+
+    bool init_uring(bool sqpoll);
+    bool init_threads();
+    static void* helper_main(void* arg);
+};
+
+#endif // ASYNC_IO_H
@@ -0,0 +1,188 @@
+#include "Channel.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <new>
+
+static size_t round_up_power_of_two(size_t n) {
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+uthread_chan::uthread_chan(size_t requested) :
+        capacity(requested ? round_up_power_of_two(requested) : 0),
+        cells(nullptr),
+        enqueue_pos(0),
+        dequeue_pos(0),
+        tail(&stub),
+        head(&stub),
+        receiver(nullptr),
+        armed(false),
+        notified(false),
+        notify_next(nullptr)
+{
+    stub.next.store(nullptr, std::memory_order_relaxed);
+    stub.msg = nullptr;
+    if (capacity) {
+        cells = new Cell[capacity];
+        for (size_t i = 0; i < capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+            cells[i].msg = nullptr;
+        }
+    }
+}
+
+uthread_chan::~uthread_chan() {
+    delete[] cells;
+    while (head) {
+        Node* next = head->next.load(std::memory_order_relaxed);
+        if (head != &stub) {
+            delete head;
+        }
+        head = next;
+    }
+}
+
+bool uthread_chan::push(void* msg) {
+    if (capacity) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & (capacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;  // the consumer has not freed this cell yet: full
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->msg = msg;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    Node* node = new (std::nothrow) Node;
+    if (!node) {
+        return false;
+    }
+    node->next.store(nullptr, std::memory_order_relaxed);
+    node->msg = msg;
+    Node* prev = tail.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+    return true;
+}
+
+bool uthread_chan::pop(void** msg) {
+    if (capacity) {
+        Cell* cell = &cells[dequeue_pos & (capacity - 1)];
+        if (cell->sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+            return false;
+        }
+        *msg = cell->msg;
+        cell->sequence.store(dequeue_pos + capacity, std::memory_order_release);
+        dequeue_pos++;
+        return true;
+    }
+    Node* next = head->next.load(std::memory_order_acquire);
+    if (!next) {
+        return false;
+    }
+    *msg = next->msg;
+    if (head != &stub) {
+        delete head;
+    }
+    head = next;
+    return true;
+}
+
+bool uthread_chan::has_message() const {
+    if (capacity) {
+        return cells[dequeue_pos & (capacity - 1)].sequence.load(std::memory_order_acquire) == dequeue_pos + 1;
+    }
+    return head->next.load(std::memory_order_acquire) != nullptr;
+}
+
+bool uthread_chan::arm() {
+    armed.store(true, std::memory_order_seq_cst);
+    // Pairs with the producer's publish-then-check: either it sees the flag or
+    // we see its message
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (has_message()) {
+        return disarm();
+    }
+    return false;
+}
+
+bool uthread_chan::disarm() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return armed.load(std::memory_order_relaxed) && armed.exchange(false, std::memory_order_acq_rel);
+}
+
+Doorbell::Doorbell() :
+        event_fd(-1),
+        rung(nullptr)
+{}
+
+Doorbell::~Doorbell() {
+    if (event_fd >= 0) {
+        close(event_fd);
+    }
+}
+
+bool Doorbell::init() {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return event_fd >= 0;
+}
+
+bool Doorbell::initialized() const {
+    return event_fd >= 0;
+}
+
+int Doorbell::fd() const {
+    return event_fd;
+}
+
+bool Doorbell::pending() const {
+    return rung.load(std::memory_order_acquire) != nullptr;
+}
+
+void Doorbell::ring(uthread_chan* ch) {
+    if (ch->notified.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    uthread_chan* first = rung.load(std::memory_order_relaxed);
+    do {
+        ch->notify_next = first;
+    } while (!rung.compare_exchange_weak(first, ch, std::memory_order_release, std::memory_order_relaxed));
+    if (!first) {
+        uint64_t one = 1;
+        ssize_t unused = write(event_fd, &one, sizeof(one));
+        (void)unused;
+    }
+}
+
+int Doorbell::drain(void (*wake)(uthread_chan*)) {
+    uint64_t value;
+    ssize_t unused = read(event_fd, &value, sizeof(value));
+    (void)unused;
+    uthread_chan* ch = rung.exchange(nullptr, std::memory_order_acquire);
+    int count = 0;
+    while (ch) {
+        // Once notified is cleared a producer may queue ch again
+        uthread_chan* next = ch->notify_next;
+        ch->notified.store(false, std::memory_order_release);
+        wake(ch);
+        ch = next;
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,109 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <atomic>
+#include <stddef.h>
+
+#include "uthreads.h"
+
+class Thread;
+
+/**
+ * @brief Multi-producer single-consumer message queue behind uthread_chan_t.
+ *
+ * Producers never lock: a bounded channel is a ring of sequence-numbered cells
+ * (a slot is claimed with one compare-and-swap and published with a release
+ * store), an unbounded one a linked list that producers append to with a
+ * single atomic exchange. Only the single consumer removes messages, so pop
+ * needs no atomic read-modify-write at all. A message whose producer has
+ * claimed but not yet published it is not visible to pop.
+ *
+ * The receiver wake-up state lives here as well: a receiver arms the channel
+ * before parking, and the producer that disarms it is responsible for waking
+ * the receiver (see Doorbell).
+ */
+struct uthread_chan {
+    // Creates a channel holding up to capacity messages (rounded up to a power
+    // of two), or an unbounded one for capacity 0. Throws std::bad_alloc.
+    explicit uthread_chan(size_t capacity);
+    ~uthread_chan();
+
+    // Appends msg, returns false if the channel is full (or, unbounded, if no
+    // memory is left). Safe from any thread.
+    bool push(void* msg);
+
+    // Removes the oldest published message into *msg, returns false if there
+    // is none. Consumer only.
+    bool pop(void** msg);
+
+    // True if pop would find a message. Consumer only.
+    bool has_message() const;
+
+    // Sets the armed flag; returns true if a message arrived meanwhile, in
+    // which case the flag was taken back and the receiver must not park
+    bool arm();
+
+    // Takes the armed flag, returns true if the caller must wake the receiver
+    bool disarm();
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        void* msg;
+    };
+
+    struct Node {
+        std::atomic<Node*> next;
+        void* msg;
+    };
+
+    size_t capacity;         // power of two, 0 when unbounded
+
+    // bounded
+    Cell* cells;
+    std::atomic<size_t> enqueue_pos;
+    size_t dequeue_pos;
+
+    // unbounded: head is a consumed dummy node, the first message is head->next
+    std::atomic<Node*> tail;
+    Node* head;
+    Node stub;
+
+    Thread* receiver;               // thread parked in a receive, nullptr if none
+    std::atomic<bool> armed;        // receiver parked, the next producer must wake it
+    std::atomic<bool> notified;     // on the Doorbell's list
+    uthread_chan* notify_next;      // link in the Doorbell's list
+};
+
+/**
+ * @brief Wakes receivers on behalf of producers that cannot touch the
+ * scheduler, i.e. kernel threads that are not library workers.
+ *
+ * ring pushes the channel onto a lock-free list and, if the list was empty,
+ * writes the eventfd, which the scheduler watches through the Reactor; the
+ * scheduler then drains the whole list and wakes the receivers.
+ */
+class Doorbell {
+public:
+    Doorbell();
+    ~Doorbell();
+
+    // Creates the eventfd, returns false on failure
+    bool init();
+    bool initialized() const;
+    int fd() const;
+
+    // True if rung since the last drain
+    bool pending() const;
+
+    // Queues ch for a receiver wake-up. Safe from any thread.
+    void ring(uthread_chan* ch);
+
+    // Passes every channel rung since the last call to wake, returns their number
+    int drain(void (*wake)(uthread_chan*));
+
+private:
+    int event_fd;
+    std::atomic<uthread_chan*> rung;
+};
+
+#endif // CHANNEL_H
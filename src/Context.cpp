@@ -0,0 +1,139 @@
+#include "Context.h"
+
+#include <stdint.h>
+
+#ifdef UTHREADS_CONTEXT_ASM
+
+#define MXCSR_DEFAULT 0x1F80
+#define FPUCW_DEFAULT 0x037F
+
+extern "C" void uthreads_swap_context(void** from_sp, void* to_sp);
+extern "C" void uthreads_jump_context(void* to_sp);
+
+/*
+ * Saved frame layout, from the saved stack pointer upward:
+ *   [x87 control word][MXCSR] r15 r14 r13 r12 rbx rbp <return address>
+ */
+asm(
+    ".text\n"
+    ".globl uthreads_swap_context\n"
+    ".type uthreads_swap_context, @function\n"
+    "uthreads_swap_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $16, %rsp\n"
+    "    stmxcsr 8(%rsp)\n"
+    "    fnstcw (%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    jmp uthreads_restore_context\n"
+    ".size uthreads_swap_context, .-uthreads_swap_context\n"
+
+    ".globl uthreads_jump_context\n"
+    ".type uthreads_jump_context, @function\n"
+    "uthreads_jump_context:\n"
+    "    movq %rdi, %rsp\n"
+    "uthreads_restore_context:\n"
+    "    ldmxcsr 8(%rsp)\n"
+    "    fldcw (%rsp)\n"
+    "    addq $16, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size uthreads_jump_context, .-uthreads_jump_context\n"
+);
+
+void context_init(Context* ctx, char* stack, size_t stack_size, void (*entry)(void)) {
+    // The return address slot is 16-byte aligned so that entry starts with the
+    // stack misaligned by 8, exactly as if it had been reached through a call.
+    uintptr_t top = ((uintptr_t)stack + stack_size) & ~(uintptr_t)15;
+    uint64_t* frame = (uint64_t*)(top - 16);
+    frame[1] = 0;                      // fake return address of entry
+    frame[0] = (uint64_t)entry;        // consumed by ret
+    frame -= 6;
+    for (int i = 0; i < 6; i++) {
+        frame[i] = 0;                  // r15 r14 r13 r12 rbx rbp
+    }
+    frame -= 2;
+    frame[0] = FPUCW_DEFAULT;
+    frame[1] = MXCSR_DEFAULT;
+    ctx->sp = frame;
+}
+
+void context_switch(Context* from, Context* to) {
+    if (from == to) {
+        return;
+    }
+    uthreads_swap_context(&from->sp, to->sp);
+}
+
+void context_jump(Context* to) {
+    uthreads_jump_context(to->sp);
+    __builtin_unreachable();
+}
+
+#else
+
+#include <signal.h>
+
+#ifdef __x86_64__
+typedef unsigned long address_t;
+#define JB_SP 6
+#define JB_PC 7
+
+static address_t translate_address(address_t addr)
+{
+    address_t ret;
+    asm volatile("xor    %%fs:0x30,%0\n"
+                 "rol    $0x11,%0\n"
+                 : "=g" (ret)
+                 : "0" (addr));
+    return ret;
+}
+#else
+typedef unsigned int address_t;
+#define JB_SP 4
+#define JB_PC 5
+
+static address_t translate_address(address_t addr)
+{
+    address_t ret;
+    asm volatile("xor    %%gs:0x18,%0\n"
+                 "rol    $0x9,%0\n"
+            : "=g" (ret)
+            : "0" (addr));
+    return ret;
+}
+#endif
+
+void context_init(Context* ctx, char* stack, size_t stack_size, void (*entry)(void)) {
+    address_t sp = (address_t)stack + stack_size - sizeof(address_t);
+    address_t pc = (address_t)entry;
+    // The saved mask is the caller's, which leaves the timer signal unblocked:
+    // critical sections are marked with the thread's in_scheduler flag, not the
+    // mask. A new thread starts with the flag set, and the entry routine clears
+    // it once the switch has been finalized.
+    sigsetjmp(ctx->env, 1);
+    ctx->env->__jmpbuf[JB_SP] = translate_address(sp);
+    ctx->env->__jmpbuf[JB_PC] = translate_address(pc);
+}
+
+void context_switch(Context* from, Context* to) {
+    if (sigsetjmp(from->env, 1) == 0) {
+        siglongjmp(to->env, 1);
+    }
+}
+
+void context_jump(Context* to) {
+    siglongjmp(to->env, 1);
+}
+
+#endif
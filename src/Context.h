@@ -0,0 +1,51 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stddef.h>
+
+/*
+ * Context switch backend.
+ *
+ * On x86-64 the default backend swaps only the callee-saved registers and the
+ * stack pointer in user space, so a switch costs no system calls. Building with
+ * -DUTHREADS_CONTEXT_SIGJMP (or on other architectures) falls back to
+ * sigsetjmp/siglongjmp, which also saves and restores the signal mask.
+ */
+#if defined(__x86_64__) && !defined(UTHREADS_CONTEXT_SIGJMP)
+#define UTHREADS_CONTEXT_ASM 1
+#endif
+
+#ifdef UTHREADS_CONTEXT_ASM
+/**
+ * @brief Saved execution context: the callee-saved registers live on the
+ * thread's own stack, so only the stack pointer is kept here.
+ */
+struct Context {
+    void* sp;
+};
+#else
+#include <setjmp.h>
+
+struct Context {
+    sigjmp_buf env;
+};
+#endif
+
+/**
+ * @brief Prepares ctx so that switching to it runs entry on the given stack.
+ * entry must never return.
+ */
+void context_init(Context* ctx, char* stack, size_t stack_size, void (*entry)(void));
+
+/**
+ * @brief Saves the running context into from and resumes to.
+ * Returns when some other thread switches back to from.
+ */
+void context_switch(Context* from, Context* to);
+
+/**
+ * @brief Resumes to without saving the running context.
+ */
+[[noreturn]] void context_jump(Context* to);
+
+#endif // CONTEXT_H
@@ -0,0 +1,173 @@
+#include "Coroutine.h"
+
+#include <errno.h>
+#include <new>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define POLL_BATCH 64 /* epoll events fetched per epoll_wait */
+
+FrameArena::FrameArena() :
+        free_frames(),
+        chunk_pos(nullptr),
+        chunk_left(0)
+{}
+
+void* FrameArena::allocate(size_t size) {
+    if (size > MAX_CLASS_SIZE) {
+        return ::operator new(size);
+    }
+    size_t index = size == 0 ? 0 : (size - 1) / CLASS_SIZE;
+    FreeFrame* frame = free_frames[index];
+    if (frame) {
+        free_frames[index] = frame->next;
+        return frame;
+    }
+    size_t rounded = (index + 1) * CLASS_SIZE;
+    if (chunk_left < rounded) {
+        // The tail of the old chunk is given up, at most MAX_CLASS_SIZE bytes
+        chunk_pos = static_cast<char*>(::operator new(CHUNK_SIZE));
+        chunk_left = CHUNK_SIZE;
+    }
+    void* block = chunk_pos;
+    chunk_pos += rounded;
+    chunk_left -= rounded;
+    return block;
+}
+
+void FrameArena::release(void* frame, size_t size) {
+    if (size > MAX_CLASS_SIZE) {
+        ::operator delete(frame);
+        return;
+    }
+    size_t index = size == 0 ? 0 : (size - 1) / CLASS_SIZE;
+    FreeFrame* free_frame = static_cast<FreeFrame*>(frame);
+    free_frame->next = free_frames[index];
+    free_frames[index] = free_frame;
+}
+
+CoroQueue::CoroQueue() :
+        head(nullptr),
+        tail(nullptr)
+{}
+
+bool CoroQueue::empty() const {
+    return head == nullptr;
+}
+
+void CoroQueue::push(uthread_coro_waiter_t* w) {
+    w->next = nullptr;
+    if (tail) {
+        tail->next = w;
+    } else {
+        head = w;
+    }
+    tail = w;
+}
+
+uthread_coro_waiter_t* CoroQueue::take_all() {
+    uthread_coro_waiter_t* first = head;
+    head = nullptr;
+    tail = nullptr;
+    return first;
+}
+
+bool CoroSleepQueue::empty() const {
+    return heap.empty();
+}
+
+uthread_coro_waiter_t* CoroSleepQueue::front() const {
+    return heap.front();
+}
+
+void CoroSleepQueue::push(uthread_coro_waiter_t* w) {
+    heap.push(w, w->wake_at);
+}
+
+uthread_coro_waiter_t* CoroSleepQueue::pop_expired(unsigned long long now) {
+    if (heap.empty() || heap.front_key() > now) {
+        return nullptr;
+    }
+    return heap.pop();
+}
+
+void CoroSleepQueue::remove(uthread_coro_waiter_t* w) {
+    heap.remove(w);
+}
+
+CoroPoller::CoroPoller() :
+        epoll_fd(-1),
+        waiters(0)
+{}
+
+CoroPoller::~CoroPoller() {
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+bool CoroPoller::has_waiters() const {
+    return waiters > 0;
+}
+
+int CoroPoller::fd() const {
+    return epoll_fd;
+}
+
+int CoroPoller::add(int fd, int events, uthread_coro_waiter_t* w) {
+    if (epoll_fd < 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            return errno;
+        }
+    }
+    if ((size_t)fd >= fds.size()) {
+        fds.resize((size_t)fd + 1, nullptr);
+    }
+    if (fds[fd]) {
+        return EBUSY;
+    }
+    struct epoll_event ev = {};
+    ev.events = ((events & UTHREAD_IO_READ) ? EPOLLIN : 0) | ((events & UTHREAD_IO_WRITE) ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        return errno;
+    }
+    fds[fd] = w;
+    w->fd = fd;
+    w->events = events;
+    w->revents = 0;
+    waiters++;
+    return 0;
+}
+
+void CoroPoller::remove(uthread_coro_waiter_t* w) {
+    int fd = w->fd;
+    if (fd < 0) {
+        return;
+    }
+    // Fails only if fd was closed meanwhile, which also dropped it from the set
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    fds[fd] = nullptr;
+    w->fd = -1;
+    waiters--;
+}
+
+int CoroPoller::poll(void (*wake)(uthread_coro_waiter_t*)) {
+    struct epoll_event events[POLL_BATCH];
+    int n = epoll_wait(epoll_fd, events, POLL_BATCH, 0);
+    if (n < 0) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        uthread_coro_waiter_t* w = fds[events[i].data.fd];
+        uint32_t ev = events[i].events;
+        // Errors and hang-ups count as ready for both: the next read or write reports them
+        int ready = ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) ? UTHREAD_IO_READ : 0) |
+                    ((ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) ? UTHREAD_IO_WRITE : 0);
+        w->revents = w->events & ready;
+        remove(w);
+        wake(w);
+    }
+    return n;
+}
@@ -0,0 +1,136 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "IntrusiveHeap.h"
+#include "uthreads.h"
+
+/**
+ * @brief Allocator of coroutine frames (uthread_coro_frame_alloc).
+ *
+ * Frames up to MAX_CLASS_SIZE bytes are rounded up to a multiple of CLASS_SIZE
+ * and carved from CHUNK_SIZE chunks; freed frames go to a free list per size
+ * class and are reused by the next frame of that class, so a task that
+ * finishes costs its successor no call into malloc. Larger frames use operator
+ * new directly. Chunks are never returned: the carrier thread may still free a
+ * frame on another worker while the process exits, so the arena has nothing
+ * for exit to destroy.
+ */
+class FrameArena {
+public:
+    FrameArena();
+
+    // Returns a block of at least size bytes. Throws std::bad_alloc.
+    void* allocate(size_t size);
+
+    // Returns a block obtained from allocate(size)
+    void release(void* frame, size_t size);
+
+private:
+    static const size_t CLASS_SIZE = 64;
+    static const size_t MAX_CLASS_SIZE = 1024;
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    struct FreeFrame {
+        FreeFrame* next;
+    };
+
+    FreeFrame* free_frames[MAX_CLASS_SIZE / CLASS_SIZE];
+    char* chunk_pos;    // unused part of the newest chunk
+    size_t chunk_left;
+};
+
+/**
+ * @brief FIFO of coroutine waiters ready to be resumed, linked through
+ * uthread_coro_waiter_t::next.
+ */
+class CoroQueue {
+public:
+    CoroQueue();
+
+    bool empty() const;
+
+    // Appends w, which must not be queued already
+    void push(uthread_coro_waiter_t* w);
+
+    // Removes every waiter, returning the oldest one; the rest follow through next
+    uthread_coro_waiter_t* take_all();
+
+private:
+    uthread_coro_waiter_t* head;
+    uthread_coro_waiter_t* tail;
+};
+
+// Position of a coroutine waiter in the CoroSleepQueue, sleep_index
+struct CoroSleepIndex {
+    static int& of(uthread_coro_waiter_t* w) {
+        return w->sleep_index;
+    }
+};
+
+/**
+ * @brief Min-heap of sleeping coroutine waiters keyed on wake_at, with each
+ * waiter's position in sleep_index (-1 when not sleeping), as SleepQueue does
+ * for threads.
+ */
+class CoroSleepQueue {
+public:
+    bool empty() const;
+
+    // Returns the earliest sleeper without removing it, or nullptr if the queue is empty
+    uthread_coro_waiter_t* front() const;
+
+    // Inserts w, which must not be sleeping, to wake at w->wake_at. Throws std::bad_alloc.
+    void push(uthread_coro_waiter_t* w);
+
+    // Returns the earliest sleeper if it is due at now, removing it; otherwise nullptr
+    uthread_coro_waiter_t* pop_expired(unsigned long long now);
+
+    // Removes w if it sleeps in this queue, otherwise does nothing
+    void remove(uthread_coro_waiter_t* w);
+
+private:
+    IntrusiveHeap<uthread_coro_waiter_t, unsigned long long, CoroSleepIndex> heap;  // keyed on a copy of wake_at
+};
+
+/**
+ * @brief epoll set of the fds coroutine waiters wait on, one waiter per fd.
+ *
+ * Kept apart from the Reactor, whose waiters are threads: the coroutine
+ * carrier thread only waits on this set's own epoll fd through the Reactor,
+ * while it has nothing else to run. Each fd is registered for exactly the
+ * events its waiter wants and removed once the waiter is woken.
+ */
+class CoroPoller {
+public:
+    CoroPoller();
+    ~CoroPoller();
+
+    // True while some waiter waits on an fd
+    bool has_waiters() const;
+
+    // The epoll fd, -1 before the first add
+    int fd() const;
+
+    // Registers w as waiting for events (UTHREAD_IO_READ / UTHREAD_IO_WRITE)
+    // on fd. Returns 0 on success, EBUSY if another waiter already waits on
+    // fd, or the errno of the failed system call. Throws std::bad_alloc.
+    int add(int fd, int events, uthread_coro_waiter_t* w);
+
+    // Stops w from waiting, if it waits on an fd
+    void remove(uthread_coro_waiter_t* w);
+
+    // Without blocking, removes every waiter whose events are ready, sets its
+    // revents and passes it to wake. Returns the number of waiters woken, or
+    // -1 if epoll_wait failed.
+    int poll(void (*wake)(uthread_coro_waiter_t*));
+
+private:
+    int epoll_fd;
+    size_t waiters;
+    std::vector<uthread_coro_waiter_t*> fds;  // indexed by fd
+};
+
+#endif // COROUTINE_H
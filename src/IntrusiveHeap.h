@@ -0,0 +1,142 @@
+#ifndef INTRUSIVE_HEAP_H
+#define INTRUSIVE_HEAP_H
+
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @brief Min-heap of T pointers ordered by a Key given to push, with each
+ * element's position in an int field of its own (-1 while it is not in the
+ * heap), so that removing an arbitrary element is O(log n).
+ *
+ * Index::of(T*) returns a reference to that field; an element is in at most
+ * one heap that uses the same field. The keys are kept next to the pointers,
+ * so comparisons and the checks on the front stay within the heap array
+ * instead of touching every element. Backs the heap-based scheduling policies
+ * (ThreadHeap), SleepQueue and CoroSleepQueue.
+ */
+template <typename T, typename Key, typename Index>
+class IntrusiveHeap {
+public:
+    bool empty() const {
+        return heap.empty();
+    }
+
+    size_t size() const {
+        return heap.size();
+    }
+
+    // Grows the capacity to at least n entries. Throws std::bad_alloc.
+    void reserve(size_t n) {
+        if (heap.capacity() < n) {
+            // Doubling, so that growing one entry at a time reallocates O(log n) times
+            heap.reserve(n > 2 * heap.capacity() ? n : 2 * heap.capacity());
+        }
+    }
+
+    // Returns the element with the smallest key without removing it, or nullptr if the heap is empty
+    T* front() const {
+        return heap.empty() ? nullptr : heap[0].item;
+    }
+
+    // Returns the smallest key; the heap must not be empty
+    Key front_key() const {
+        return heap[0].key;
+    }
+
+    // Inserts item, which must not be in the heap, with the given key. Throws
+    // std::bad_alloc unless reserve made room for it.
+    void push(T* item, Key key) {
+        Entry e = {key, item};
+        heap.push_back(e);
+        sift_up(heap.size() - 1);
+    }
+
+    // Removes and returns the element with the smallest key, or nullptr if the heap is empty
+    T* pop() {
+        if (heap.empty()) {
+            return nullptr;
+        }
+        T* item = heap[0].item;
+        remove(item);
+        return item;
+    }
+
+    // Whether item is in this heap
+    bool contains(const T* item) const {
+        int index = Index::of(const_cast<T*>(item));
+        return index >= 0 && (size_t)index < heap.size() && heap[index].item == item;
+    }
+
+    // Removes item if it is in this heap, otherwise does nothing
+    void remove(T* item) {
+        if (!contains(item)) {
+            return;
+        }
+        size_t index = (size_t)Index::of(item);
+        Entry last = heap.back();
+        heap.pop_back();
+        Index::of(item) = -1;
+        if (last.item != item) {
+            place(index, last);
+            sift_down(index);
+            sift_up((size_t)Index::of(last.item));
+        }
+    }
+
+    // Removes every element
+    void clear() {
+        for (const Entry& e : heap) {
+            Index::of(e.item) = -1;
+        }
+        heap.clear();
+    }
+
+private:
+    struct Entry {
+        Key key;
+        T* item;
+    };
+
+    std::vector<Entry> heap;
+
+    void place(size_t i, const Entry& e) {
+        heap[i] = e;
+        Index::of(e.item) = (int)i;
+    }
+
+    void sift_up(size_t i) {
+        Entry e = heap[i];
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (heap[parent].key <= e.key) {
+                break;
+            }
+            place(i, heap[parent]);
+            i = parent;
+        }
+        place(i, e);
+    }
+
+    void sift_down(size_t i) {
+        Entry e = heap[i];
+        size_t n = heap.size();
+        while (true) {
+            size_t child = 2 * i + 1;
+            if (child >= n) {
+                break;
+            }
+            if (child + 1 < n && heap[child + 1].key < heap[child].key) {
+                child++;
+            }
+            if (e.key <= heap[child].key) {
+                break;
+            }
+            place(i, heap[child]);
+            i = child;
+        }
+        place(i, e);
+    }
+};
+
+#endif // INTRUSIVE_HEAP_H
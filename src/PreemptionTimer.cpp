@@ -0,0 +1,71 @@
+#include "PreemptionTimer.h"
+
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "uthreads.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+PreemptionTimer::PreemptionTimer() :
+        mode(UTHREAD_TIMER_PROCESS),
+        created(false),
+        id()
+{}
+
+PreemptionTimer::~PreemptionTimer() {
+    if (created) {
+        timer_delete(id);
+    }
+}
+
+bool PreemptionTimer::init(int timer_mode, int signal) {
+    mode = timer_mode;
+    if (mode == UTHREAD_TIMER_PROCESS || mode == UTHREAD_TIMER_NONE) {
+        return true;
+    }
+    struct sigevent sev = {};
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = signal;
+    sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    clockid_t clock = mode == UTHREAD_TIMER_THREAD_CPU ? CLOCK_THREAD_CPUTIME_ID : CLOCK_MONOTONIC;
+    if (timer_create(clock, &sev, &id) == -1) {
+        return false;
+    }
+    created = true;
+    return true;
+}
+
+bool PreemptionTimer::arm(int usecs) {
+    if (mode == UTHREAD_TIMER_NONE) {
+        return true;
+    }
+    if (mode == UTHREAD_TIMER_PROCESS) {
+        struct itimerval timer = {};
+        timer.it_value.tv_sec = usecs / 1000000;
+        timer.it_value.tv_usec = usecs % 1000000;
+        timer.it_interval = timer.it_value;
+        return setitimer(ITIMER_VIRTUAL, &timer, nullptr) != -1;
+    }
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = usecs / 1000000;
+    spec.it_value.tv_nsec = (long)(usecs % 1000000) * 1000;
+    spec.it_interval = spec.it_value;
+    return timer_settime(id, 0, &spec, nullptr) != -1;
+}
+
+bool PreemptionTimer::disarm() {
+    if (mode == UTHREAD_TIMER_NONE) {
+        return true;
+    }
+    if (mode == UTHREAD_TIMER_PROCESS) {
+        struct itimerval timer = {};
+        return setitimer(ITIMER_VIRTUAL, &timer, nullptr) != -1;
+    }
+    struct itimerspec spec = {};
+    return timer_settime(id, 0, &spec, nullptr) != -1;
+}
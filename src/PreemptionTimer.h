@@ -0,0 +1,35 @@
+#ifndef PREEMPTION_TIMER_H
+#define PREEMPTION_TIMER_H
+
+#include <time.h>
+
+/**
+ * @brief Periodic timer that raises the preemption signal on a worker.
+ *
+ * In UTHREAD_TIMER_PROCESS mode this is the process-wide ITIMER_VIRTUAL shared
+ * by every worker. The other modes create a POSIX timer per worker that is
+ * delivered to that worker's kernel thread only (SIGEV_THREAD_ID), measuring
+ * either the thread's CPU time or wall-clock time. In UTHREAD_TIMER_NONE mode
+ * there is no timer and every operation succeeds without doing anything.
+ */
+class PreemptionTimer {
+public:
+    PreemptionTimer();
+    ~PreemptionTimer();
+
+    // Sets up the timer for the calling kernel thread, returns false on failure
+    bool init(int mode, int signal);
+
+    // (Re)starts a periodic interval of usecs micro-seconds, returns false on failure
+    bool arm(int usecs);
+
+    // Stops the timer, returns false on failure
+    bool disarm();
+
+private:
+    int mode;
+    bool created;
+    timer_t id;
+};
+
+#endif // PREEMPTION_TIMER_H
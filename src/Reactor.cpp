@@ -0,0 +1,157 @@
+#include "Reactor.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "Thread.h"
+
+#define POLL_BATCH 64 /* epoll events fetched per epoll_wait */
+
+Reactor::Reactor() :
+        epoll_fd(-1),
+        waiters(0)
+{}
+
+Reactor::~Reactor() {
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+bool Reactor::has_waiters() const {
+    return waiters > 0;
+}
+
+/**
+ * Bring the epoll registration of fd in line with its waiters.
+ */
+int Reactor::update(int fd) {
+    FdWaiters& w = fds[fd];
+    uint32_t wanted = (w.reader ? EPOLLIN : 0) | (w.writer ? EPOLLOUT : 0);
+    if (wanted == w.registered) {
+        return 0;
+    }
+    struct epoll_event ev = {};
+    ev.events = wanted;
+    ev.data.fd = fd;
+    int op = !wanted ? EPOLL_CTL_DEL : w.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epoll_fd, op, fd, &ev) == -1) {
+        return errno;
+    }
+    w.registered = wanted;
+    return 0;
+}
+
+/**
+ * Create the epoll instance on first use and make room for fd in the table.
+ */
+int Reactor::open_fd(int fd) {
+    if (epoll_fd < 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            return errno;
+        }
+    }
+    if ((size_t)fd >= fds.size()) {
+        fds.resize((size_t)fd + 1, FdWaiters{nullptr, nullptr, 0});
+    }
+    return 0;
+}
+
+int Reactor::watch(int fd) {
+    int err = open_fd(fd);
+    if (err) {
+        return err;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        return errno;
+    }
+    fds[fd].registered = EPOLLIN;
+    return 0;
+}
+
+int Reactor::add(int fd, int events, Thread* t) {
+    int err = open_fd(fd);
+    if (err) {
+        return err;
+    }
+    FdWaiters& w = fds[fd];
+    bool read = events & UTHREAD_IO_READ;
+    bool write = events & UTHREAD_IO_WRITE;
+    if ((read && w.reader) || (write && w.writer)) {
+        return EBUSY;
+    }
+    if (read) {
+        w.reader = t;
+    }
+    if (write) {
+        w.writer = t;
+    }
+    err = update(fd);
+    if (err) {
+        if (read) {
+            w.reader = nullptr;
+        }
+        if (write) {
+            w.writer = nullptr;
+        }
+        return err;
+    }
+    t->io_fd = fd;
+    t->io_events = events;
+    t->io_revents = 0;
+    waiters++;
+    return 0;
+}
+
+void Reactor::remove(Thread* t) {
+    int fd = t->io_fd;
+    if (fd < 0) {
+        return;
+    }
+    FdWaiters& w = fds[fd];
+    if (w.reader == t) {
+        w.reader = nullptr;
+    }
+    if (w.writer == t) {
+        w.writer = nullptr;
+    }
+    // Fails only if fd was closed meanwhile, which also dropped it from the set
+    if (update(fd) != 0) {
+        w.registered = 0;
+    }
+    t->io_fd = -1;
+    waiters--;
+}
+
+int Reactor::poll(int timeout_ms, void (*wake)(Thread*)) {
+    struct epoll_event events[POLL_BATCH];
+    int n = epoll_wait(epoll_fd, events, POLL_BATCH, timeout_ms);
+    if (n < 0) {
+        return -1;
+    }
+    int woken = 0;
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        uint32_t ev = events[i].events;
+        // Errors and hang-ups wake both sides: the next read or write reports them
+        int ready = ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) ? UTHREAD_IO_READ : 0) |
+                    ((ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) ? UTHREAD_IO_WRITE : 0);
+        Thread* candidates[2] = {fds[fd].reader, fds[fd].writer};
+        for (int k = 0; k < 2; k++) {
+            Thread* t = candidates[k];
+            if (!t || t->io_fd != fd || !(t->io_events & ready)) {
+                continue;  // none waiting, or already woken through the other side
+            }
+            t->io_revents = t->io_events & ready;
+            remove(t);
+            wake(t);
+            woken++;
+        }
+    }
+    return woken;
+}
@@ -0,0 +1,63 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class Thread;
+
+/**
+ * @brief epoll set of the file descriptors that parked threads wait on.
+ *
+ * Each fd has at most one thread waiting to read and one waiting to write (the
+ * same thread may wait for both); the fd is registered, level-triggered, for
+ * exactly the events someone waits for and is removed from the epoll set once
+ * nobody does. A waiting thread records its fd in Thread::io_fd (-1 otherwise)
+ * and, once woken, the ready events in Thread::io_revents. The epoll instance
+ * is only created by the first add or watch, so programs that never wait on
+ * an fd do not pay for it.
+ */
+class Reactor {
+public:
+    Reactor();
+    ~Reactor();
+
+    // True while some thread waits on an fd
+    bool has_waiters() const;
+
+    // Registers t, which must not be waiting already, as waiting for events
+    // (UTHREAD_IO_READ / UTHREAD_IO_WRITE) on fd. Returns 0 on success, EBUSY
+    // if another thread already waits for one of these events on fd, or the
+    // errno of the failed system call. Throws std::bad_alloc.
+    int add(int fd, int events, Thread* t);
+
+    // Adds fd, on which no thread waits, to the epoll set for good, so that
+    // poll also returns when fd is readable. Returns 0 or an errno value.
+    int watch(int fd);
+
+    // Stops t from waiting, if it waits on an fd
+    void remove(Thread* t);
+
+    // Waits up to timeout_ms (-1 = forever) for ready fds. Every thread whose
+    // events are ready is removed, gets its io_revents set and is passed to
+    // wake. Returns the number of threads woken, or -1 if epoll_wait failed
+    // (errno is EINTR when a signal interrupted it).
+    int poll(int timeout_ms, void (*wake)(Thread*));
+
+private:
+    struct FdWaiters {
+        Thread* reader;
+        Thread* writer;
+        uint32_t registered;  // epoll events the fd is registered for, 0 when not in the set
+    };
+
+    int epoll_fd;
+    size_t waiters;
+    std::vector<FdWaiters> fds;  // indexed by fd
+
+    int update(int fd);
+    int open_fd(int fd);
+};
+
+#endif // REACTOR_H
@@ -0,0 +1,121 @@
+#include "RunQueue.h"
+
+#include "Thread.h"
+
+RunQueue::RunQueue(int aging_interval) :
+        non_empty(0),
+        count(0),
+        aging_interval(aging_interval),
+        picks_since_aging(0)
+{
+    for (int p = 0; p < UTHREAD_PRIORITY_LEVELS; p++) {
+        levels[p].head = nullptr;
+        levels[p].tail = nullptr;
+    }
+}
+
+bool RunQueue::empty() const {
+    return non_empty == 0;
+}
+
+size_t RunQueue::size() const {
+    return count;
+}
+
+Thread* RunQueue::front() const {
+    if (non_empty == 0) {
+        return nullptr;
+    }
+    return levels[31 - __builtin_clz(non_empty)].head;
+}
+
+void RunQueue::link(Thread* t, int priority) {
+    Level& level = levels[priority];
+    t->rq_prev = level.tail;
+    t->rq_next = nullptr;
+    if (level.tail) {
+        level.tail->rq_next = t;
+    } else {
+        level.head = t;
+        non_empty |= (uint32_t)1 << priority;
+    }
+    level.tail = t;
+    t->queued_priority = priority;
+    t->run_queue = this;
+    count++;
+}
+
+void RunQueue::unlink(Thread* t) {
+    Level& level = levels[t->queued_priority];
+    if (t->rq_prev) {
+        t->rq_prev->rq_next = t->rq_next;
+    } else {
+        level.head = t->rq_next;
+    }
+    if (t->rq_next) {
+        t->rq_next->rq_prev = t->rq_prev;
+    } else {
+        level.tail = t->rq_prev;
+    }
+    if (!level.head) {
+        non_empty &= ~((uint32_t)1 << t->queued_priority);
+    }
+    t->rq_prev = nullptr;
+    t->rq_next = nullptr;
+    t->run_queue = nullptr;
+    count--;
+}
+
+void RunQueue::push(Thread* t) {
+    if (t->run_queue) {
+        return;
+    }
+    link(t, t->dynamic_priority);
+}
+
+Thread* RunQueue::pop() {
+    Thread* t = front();
+    if (t) {
+        unlink(t);
+    }
+    return t;
+}
+
+void RunQueue::remove(Thread* t) {
+    if (t->run_queue != this) {
+        return;
+    }
+    unlink(t);
+}
+
+void RunQueue::age() {
+    // Top-down, so that a thread is promoted at most once per call
+    for (int p = UTHREAD_PRIORITY_LEVELS - 2; p >= 0; p--) {
+        Thread* t = levels[p].head;
+        if (t) {
+            unlink(t);
+            t->dynamic_priority = p + 1;
+            link(t, p + 1);
+        }
+    }
+}
+
+void RunQueue::enqueue(Thread* t) {
+    push(t);
+}
+
+void RunQueue::dequeue(Thread* t) {
+    remove(t);
+}
+
+Thread* RunQueue::pick_next() {
+    if (aging_interval > 0 && ++picks_since_aging >= aging_interval) {
+        picks_since_aging = 0;
+        age();
+    }
+    Thread* t = pop();
+    if (t) {
+        t->dynamic_priority = t->priority;
+    }
+    return t;
+}
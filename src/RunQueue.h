@@ -0,0 +1,70 @@
+#ifndef RUN_QUEUE_H
+#define RUN_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SchedPolicy.h"
+#include "uthreads.h"
+
+class Thread;
+
+/**
+ * @brief UTHREAD_SCHED_RR, the default policy: multi-level queue of READY
+ * threads, one FIFO per priority level, linked through Thread::rq_prev /
+ * rq_next.
+ *
+ * A bitmap records the non-empty levels, so finding the highest priority READY
+ * thread is a single find-first-set. Every operation is O(1) and allocation
+ * free, including removing a thread from the middle of a level. A thread is in
+ * at most one queue at a time (Thread::run_queue) and is queued at its
+ * Thread::dynamic_priority; pushing a thread that is already queued has no
+ * effect. With an aging interval, every aging_interval picks the oldest thread
+ * of each level below the top one moves up a level; a thread returns to its
+ * own priority once picked.
+ */
+class RunQueue : public SchedPolicy {
+public:
+    explicit RunQueue(int aging_interval = 0);
+
+    bool empty() const override;
+    size_t size() const override;
+
+    // Returns the thread pop would return, or nullptr if the queue is empty
+    Thread* front() const;
+
+    // Appends t to the back of its priority level, unless it is already queued
+    void push(Thread* t);
+
+    // Removes and returns the oldest thread of the highest non-empty level, or nullptr
+    Thread* pop();
+
+    // Unlinks t if it is queued here, otherwise does nothing
+    void remove(Thread* t);
+
+    // Moves the oldest thread of every non-empty level below the top one up by one level
+    void age();
+
+    void enqueue(Thread* t) override;
+    void dequeue(Thread* t) override;
+
+    // Ages the queue when due, then pops the next thread at its own priority
+    Thread* pick_next() override;
+
+private:
+    struct Level {
+        Thread* head;
+        Thread* tail;
+    };
+
+    Level levels[UTHREAD_PRIORITY_LEVELS];
+    uint32_t non_empty;  // bit p set = levels[p] has threads
+    size_t count;
+    int aging_interval;     // picks between aging passes, 0 disables aging
+    int picks_since_aging;
+
+    void link(Thread* t, int priority);
+    void unlink(Thread* t);
+};
+
+#endif // RUN_QUEUE_H
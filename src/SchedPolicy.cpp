@@ -0,0 +1,136 @@
+#include "SchedPolicy.h"
+
+#include "RunQueue.h"
+#include "Thread.h"
+
+#define FAIR_WEIGHT_DEFAULT 1024 /* weight of a thread at UTHREAD_PRIORITY_DEFAULT */
+#define EDF_NO_DEADLINE (1ULL << 63) /* keys of threads without a deadline start here */
+
+SchedPolicy::~SchedPolicy() {}
+
+void SchedPolicy::charge(Thread* t, unsigned long long cycles) {
+    (void)t;
+    (void)cycles;
+}
+
+void SchedPolicy::reserve(size_t threads) {
+    (void)threads;
+}
+
+void SchedPolicy::clear() {
+    while (pick_next()) {}
+}
+
+SchedPolicy* make_sched_policy(int policy, int aging_interval) {
+    switch (policy) {
+    case UTHREAD_SCHED_FAIR:
+        return new FairQueue();
+    case UTHREAD_SCHED_EDF:
+        return new DeadlineQueue();
+    default:
+        return new RunQueue(aging_interval);
+    }
+}
+
+int& ThreadHeapIndex::of(Thread* t) {
+    return t->rq_index;
+}
+
+FairQueue::FairQueue() :
+        min_vruntime(0)
+{
+    // 1.25 times the weight per level up, as from one nice level to the next in Linux
+    weights[UTHREAD_PRIORITY_DEFAULT] = FAIR_WEIGHT_DEFAULT;
+    for (int p = UTHREAD_PRIORITY_DEFAULT + 1; p < UTHREAD_PRIORITY_LEVELS; p++) {
+        weights[p] = weights[p - 1] * 5 / 4;
+    }
+    for (int p = UTHREAD_PRIORITY_DEFAULT - 1; p >= 0; p--) {
+        weights[p] = weights[p + 1] * 4 / 5;
+    }
+}
+
+bool FairQueue::empty() const {
+    return heap.empty();
+}
+
+size_t FairQueue::size() const {
+    return heap.size();
+}
+
+void FairQueue::enqueue(Thread* t) {
+    if (t->run_queue) {
+        return;
+    }
+    if (t->vruntime < min_vruntime) {
+        t->vruntime = min_vruntime;
+    }
+    heap.push(t, t->vruntime);
+    t->run_queue = this;
+}
+
+void FairQueue::dequeue(Thread* t) {
+    if (t->run_queue != this) {
+        return;
+    }
+    heap.remove(t);
+    t->run_queue = nullptr;
+}
+
+Thread* FairQueue::pick_next() {
+    Thread* t = heap.pop();
+    if (t) {
+        t->run_queue = nullptr;
+        if (t->vruntime > min_vruntime) {
+            min_vruntime = t->vruntime;
+        }
+    }
+    return t;
+}
+
+void FairQueue::charge(Thread* t, unsigned long long cycles) {
+    t->vruntime += cycles * FAIR_WEIGHT_DEFAULT / weights[t->priority];
+}
+
+void FairQueue::reserve(size_t threads) {
+    heap.reserve(threads);
+}
+
+DeadlineQueue::DeadlineQueue() :
+        sequence(0)
+{}
+
+bool DeadlineQueue::empty() const {
+    return heap.empty();
+}
+
+size_t DeadlineQueue::size() const {
+    return heap.size();
+}
+
+void DeadlineQueue::enqueue(Thread* t) {
+    if (t->run_queue) {
+        return;
+    }
+    heap.push(t, t->deadline ? t->deadline : EDF_NO_DEADLINE + sequence++);
+    t->run_queue = this;
+}
+
+void DeadlineQueue::dequeue(Thread* t) {
+    if (t->run_queue != this) {
+        return;
+    }
+    heap.remove(t);
+    t->run_queue = nullptr;
+}
+
+Thread* DeadlineQueue::pick_next() {
+    Thread* t = heap.pop();
+    if (t) {
+        t->run_queue = nullptr;
+    }
+    return t;
+}
+
+void DeadlineQueue::reserve(size_t threads) {
+    heap.reserve(threads);
+}
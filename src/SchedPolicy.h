@@ -0,0 +1,118 @@
+#ifndef SCHED_POLICY_H
+#define SCHED_POLICY_H
+
+#include <stddef.h>
+
+#include "IntrusiveHeap.h"
+#include "uthreads.h"
+
+class Thread;
+
+/**
+ * @brief Scheduling policy: the queue of a worker's READY threads and the
+ * order they run in.
+ *
+ * Each worker owns one instance of the policy chosen at uthread_init
+ * (UTHREAD_SCHED_*). A queued thread records its queue in Thread::run_queue;
+ * enqueueing a thread that is already queued has no effect. Only called with
+ * the scheduler locked.
+ */
+class SchedPolicy {
+public:
+    virtual ~SchedPolicy();
+
+    virtual bool empty() const = 0;
+    virtual size_t size() const = 0;
+
+    // Queues t, which just became READY, unless it is already queued
+    virtual void enqueue(Thread* t) = 0;
+
+    // Unlinks t if it is queued here, otherwise does nothing
+    virtual void dequeue(Thread* t) = 0;
+
+    // Removes and returns the thread to run next, or nullptr if the queue is empty
+    virtual Thread* pick_next() = 0;
+
+    // t leaves the CPU after running for cycles, whether its quantum expired
+    // or it yielded, blocked or exited. Called before t is queued again.
+    virtual void charge(Thread* t, unsigned long long cycles);
+
+    // Makes room for up to threads queued at the same time, so that enqueue
+    // does not allocate. Throws std::bad_alloc.
+    virtual void reserve(size_t threads);
+
+    // Unlinks every thread
+    void clear();
+};
+
+/**
+ * @brief Creates the UTHREAD_SCHED_* policy of a worker. aging_interval is
+ * passed to the round-robin policy. Throws std::bad_alloc.
+ */
+SchedPolicy* make_sched_policy(int policy, int aging_interval);
+
+// Position of a thread in a ThreadHeap, Thread::rq_index
+struct ThreadHeapIndex {
+    static int& of(Thread* t);
+};
+
+/**
+ * @brief Min-heap of threads keyed on a value fixed when they are pushed,
+ * with each thread's position in Thread::rq_index.
+ */
+typedef IntrusiveHeap<Thread, unsigned long long, ThreadHeapIndex> ThreadHeap;
+
+/**
+ * @brief UTHREAD_SCHED_FAIR: CPU time shared in proportion to weights.
+ *
+ * Every thread accumulates virtual run time, its run time scaled down by its
+ * weight (Thread::vruntime), and the thread with the least virtual run time
+ * runs next. The weight follows the thread's priority: FAIR_WEIGHT_DEFAULT at
+ * UTHREAD_PRIORITY_DEFAULT and 25% more per level above it, so two threads
+ * ten levels apart share the CPU about 9:1. A thread that becomes READY after
+ * blocking or sleeping starts from the queue's minimum virtual run time, so
+ * it neither lost its turn nor saved up CPU time while away.
+ */
+class FairQueue : public SchedPolicy {
+public:
+    FairQueue();
+
+    bool empty() const override;
+    size_t size() const override;
+    void enqueue(Thread* t) override;
+    void dequeue(Thread* t) override;
+    Thread* pick_next() override;
+    void charge(Thread* t, unsigned long long cycles) override;
+    void reserve(size_t threads) override;
+
+private:
+    ThreadHeap heap;
+    unsigned long long min_vruntime;  // virtual run time of the last thread picked, never decreases
+    unsigned long long weights[UTHREAD_PRIORITY_LEVELS];  // weight of each priority
+};
+
+/**
+ * @brief UTHREAD_SCHED_EDF: earliest deadline first.
+ *
+ * Threads with a deadline (uthread_set_deadline, Thread::deadline) run in
+ * deadline order, a missed deadline first of all; threads without one run
+ * round-robin, in the order they became READY, whenever no thread with a
+ * deadline is READY. Priorities are not used.
+ */
+class DeadlineQueue : public SchedPolicy {
+public:
+    DeadlineQueue();
+
+    bool empty() const override;
+    size_t size() const override;
+    void enqueue(Thread* t) override;
+    void dequeue(Thread* t) override;
+    Thread* pick_next() override;
+    void reserve(size_t threads) override;
+
+private:
+    ThreadHeap heap;
+    unsigned long long sequence;  // orders the threads without a deadline
+};
+
+#endif // SCHED_POLICY_H
@@ -0,0 +1,46 @@
+#include "SleepQueue.h"
+
+#include "Thread.h"
+
+int& SleepIndex::of(Thread* t) {
+    return t->sleep_index;
+}
+
+bool SleepQueue::empty() const {
+    return heap.empty();
+}
+
+size_t SleepQueue::size() const {
+    return heap.size();
+}
+
+void SleepQueue::reserve(size_t threads) {
+    heap.reserve(threads);
+}
+
+Thread* SleepQueue::front() const {
+    return heap.front();
+}
+
+void SleepQueue::push(Thread* t) {
+    heap.push(t, t->wake_at);
+}
+
+Thread* SleepQueue::pop_expired(unsigned long long now) {
+    if (heap.empty() || heap.front_key() > now) {
+        return nullptr;
+    }
+    return heap.pop();
+}
+
+bool SleepQueue::contains(const Thread* t) const {
+    return heap.contains(t);
+}
+
+void SleepQueue::remove(Thread* t) {
+    heap.remove(t);
+}
+
+void SleepQueue::clear() {
+    heap.clear();
+}
@@ -0,0 +1,55 @@
+#ifndef SLEEP_QUEUE_H
+#define SLEEP_QUEUE_H
+
+#include <stddef.h>
+
+#include "IntrusiveHeap.h"
+
+class Thread;
+
+// Position of a thread in its SleepQueue, Thread::sleep_index
+struct SleepIndex {
+    static int& of(Thread* t);
+};
+
+/**
+ * @brief Min-heap of sleeping threads keyed on their absolute wake-up time
+ * (Thread::wake_at), so that waking costs O(expired * log n) instead of a walk
+ * over every sleeper.
+ *
+ * Each thread records its heap position in Thread::sleep_index (-1 when it is
+ * not sleeping), which makes removing an arbitrary sleeper O(log n). A thread
+ * sleeps in at most one queue at a time.
+ */
+class SleepQueue {
+public:
+    bool empty() const;
+    size_t size() const;
+
+    // Returns the earliest sleeper without removing it, or nullptr if the queue is empty
+    Thread* front() const;
+
+    // Grows the capacity to at least threads entries. Throws std::bad_alloc.
+    void reserve(size_t threads);
+
+    // Inserts t, which must not be sleeping, to wake at t->wake_at. Throws
+    // std::bad_alloc unless reserve made room for it.
+    void push(Thread* t);
+
+    // Returns the earliest sleeper if it is due at now (wake_at <= now), removing it; otherwise nullptr
+    Thread* pop_expired(unsigned long long now);
+
+    // Whether t sleeps in this queue
+    bool contains(const Thread* t) const;
+
+    // Removes t if it sleeps in this queue, otherwise does nothing
+    void remove(Thread* t);
+
+    // Removes every sleeper
+    void clear();
+
+private:
+    IntrusiveHeap<Thread, unsigned long long, SleepIndex> heap;  // keyed on a copy of wake_at
+};
+
+#endif // SLEEP_QUEUE_H
@@ -0,0 +1,34 @@
+#ifndef SPIN_LOCK_H
+#define SPIN_LOCK_H
+
+#include <atomic>
+
+/**
+ * @brief Test-and-test-and-set spin lock.
+ *
+ * Not tied to an owner: in the scheduler, the lock taken before a context
+ * switch is released by whichever thread resumes on the same kernel thread.
+ */
+class SpinLock {
+public:
+    SpinLock() : locked(false) {}
+
+    void lock() {
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+            }
+        }
+    }
+
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked;
+};
+
+#endif // SPIN_LOCK_H
@@ -0,0 +1,61 @@
+#include "Stack.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static size_t page_size() {
+    static size_t size = 0;
+    if (size == 0) {
+        long ret = sysconf(_SC_PAGESIZE);
+        size = ret > 0 ? (size_t)ret : 4096;
+    }
+    return size;
+}
+
+bool stack_size_valid(size_t size) {
+    // One page for the rounding, one for the guard page
+    return size > 0 && size <= SIZE_MAX - 2 * page_size();
+}
+
+size_t stack_round_size(size_t size) {
+    size_t page = page_size();
+    size_t usable = (size + page - 1) & ~(page - 1);
+    return usable == 0 ? page : usable;
+}
+
+bool stack_allocate(Stack* stack, size_t size) {
+    if (!stack_size_valid(size)) {
+        return false;
+    }
+    size_t page = page_size();
+    size_t usable = stack_round_size(size);
+    void* mapping = mmap(nullptr, usable + page, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    if (mprotect(mapping, page, PROT_NONE) == -1) {
+        munmap(mapping, usable + page);
+        return false;
+    }
+    stack->base = (char*)mapping + page;
+    stack->size = usable;
+    return true;
+}
+
+void stack_release(Stack* stack) {
+    if (stack->base) {
+        size_t page = page_size();
+        munmap(stack->base - page, stack->size + page);
+        stack->base = nullptr;
+        stack->size = 0;
+    }
+}
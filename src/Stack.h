@@ -0,0 +1,42 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stddef.h>
+
+/**
+ * @brief A thread stack mapped with mmap, with a PROT_NONE guard page below it
+ * so that an overflow faults instead of corrupting neighbouring memory.
+ *
+ * The mapping is lazily committed: only the pages a thread actually touches
+ * cost physical memory.
+ */
+struct Stack {
+    char* base;         // lowest usable address (just above the guard page)
+    size_t size;        // usable size in bytes, a multiple of the page size
+};
+
+/**
+ * @brief Returns true if a stack of size bytes can be mapped at all: not 0, and
+ * small enough that rounding it to pages and adding the guard page does not
+ * overflow.
+ */
+bool stack_size_valid(size_t size);
+
+/**
+ * @brief Returns the usable size stack_allocate would map for a request of size
+ * bytes, which must be valid (stack_size_valid).
+ */
+size_t stack_round_size(size_t size);
+
+/**
+ * @brief Maps a stack of at least size bytes.
+ * @return true on success, false if size is not valid or the mapping could not be created.
+ */
+bool stack_allocate(Stack* stack, size_t size);
+
+/**
+ * @brief Unmaps a stack created by stack_allocate. Safe on an empty stack.
+ */
+void stack_release(Stack* stack);
+
+#endif // STACK_H
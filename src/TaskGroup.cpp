@@ -0,0 +1,111 @@
+#include "TaskGroup.h"
+
+uthread_taskgroup::uthread_taskgroup() :
+        head(nullptr),
+        tail(nullptr),
+        unfinished(0),
+        waiters{nullptr, nullptr},
+        ready_prev(nullptr),
+        ready_next(nullptr),
+        ready(false)
+{}
+
+TaskQueue::TaskQueue() :
+        head(nullptr),
+        tail(nullptr),
+        free_tasks(nullptr)
+{}
+
+TaskQueue::~TaskQueue() {
+    while (free_tasks) {
+        Task* t = free_tasks;
+        free_tasks = t->next;
+        delete t;
+    }
+}
+
+bool TaskQueue::empty() const {
+    return head == nullptr;
+}
+
+void TaskQueue::push(Task* t) {
+    uthread_taskgroup* g = t->group;
+    t->next = nullptr;
+    if (g->tail) {
+        g->tail->next = t;
+    } else {
+        g->head = t;
+    }
+    g->tail = t;
+    if (!g->ready) {
+        g->ready = true;
+        g->ready_prev = tail;
+        g->ready_next = nullptr;
+        if (tail) {
+            tail->ready_next = g;
+        } else {
+            head = g;
+        }
+        tail = g;
+    }
+}
+
+Task* TaskQueue::take(long* begin, long* end) {
+    return head ? take_from(head, begin, end) : nullptr;
+}
+
+Task* TaskQueue::take_from(uthread_taskgroup* g, long* begin, long* end) {
+    Task* t = g->head;
+    if (!t) {
+        return nullptr;
+    }
+    bool done = true;
+    if (t->range_fn) {
+        *begin = t->next_index;
+        // Without overflowing next_index + grain near LONG_MAX
+        *end = (unsigned long)t->end - (unsigned long)*begin > (unsigned long)t->grain ? *begin + t->grain : t->end;
+        t->next_index = *end;
+        done = *end == t->end;
+    }
+    if (done) {
+        g->head = t->next;
+        if (!g->head) {
+            g->tail = nullptr;
+            unlink(g);
+        }
+    }
+    return t;
+}
+
+void TaskQueue::unlink(uthread_taskgroup* g) {
+    if (!g->ready) {
+        return;
+    }
+    if (g->ready_prev) {
+        g->ready_prev->ready_next = g->ready_next;
+    } else {
+        head = g->ready_next;
+    }
+    if (g->ready_next) {
+        g->ready_next->ready_prev = g->ready_prev;
+    } else {
+        tail = g->ready_prev;
+    }
+    g->ready_prev = nullptr;
+    g->ready_next = nullptr;
+    g->ready = false;
+}
+
+Task* TaskQueue::allocate() {
+    Task* t = free_tasks;
+    if (t) {
+        free_tasks = t->next;
+        return t;
+    }
+    return new Task();
+}
+
+void TaskQueue::release(Task* t) {
+    t->next = free_tasks;
+    free_tasks = t;
+}
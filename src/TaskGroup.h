@@ -0,0 +1,81 @@
+#ifndef TASK_GROUP_H
+#define TASK_GROUP_H
+
+#include <stddef.h>
+
+#include "uthreads.h"
+
+/**
+ * @brief Work queued on a task group: one call fn(arg), or a range of indexes
+ * that is handed out grain indexes at a time (uthread_parallel_for).
+ */
+struct Task {
+    Task* next;                  // link in the group's queue or in the free list
+    uthread_taskgroup* group;
+    uthread_task_fn fn;          // single task
+    void* arg;
+    uthread_range_fn range_fn;   // range, nullptr for a single task
+    void* ctx;
+    long next_index;             // first index not handed out yet
+    long end;
+    long grain;
+};
+
+/**
+ * @brief Tasks of one uthread_taskgroup_t and the threads waiting for them.
+ * Only touched with the scheduler locked.
+ */
+struct uthread_taskgroup {
+    uthread_taskgroup();
+
+    Task* head;                      // tasks nobody has started, oldest first
+    Task* tail;
+    unsigned long unfinished;        // tasks and range chunks queued or running
+    uthread_wait_queue_t waiters;    // threads in uthread_taskgroup_wait
+    uthread_taskgroup* ready_prev;   // links in the TaskQueue, while head is set
+    uthread_taskgroup* ready_next;
+    bool ready;
+};
+
+/**
+ * @brief FIFO of the task groups that have tasks nobody has started, served by
+ * the task helper threads, plus a free list of Task nodes so that spawning a
+ * task does not allocate once warm.
+ *
+ * A group is linked here exactly while it has unstarted tasks. A range stays
+ * at the front of its group until its last chunk is handed out, so a range
+ * costs one Task however many chunks it has.
+ */
+class TaskQueue {
+public:
+    TaskQueue();
+    ~TaskQueue();
+
+    bool empty() const;
+
+    // Appends t to its group, queueing the group if needed
+    void push(Task* t);
+
+    // Takes the next piece of work of the oldest group, see take_from
+    Task* take(long* begin, long* end);
+
+    // Takes the next piece of work of g: a single task is unlinked and
+    // returned; a range returns its next chunk in [*begin, *end) and is
+    // unlinked with its last chunk. Returns nullptr if g has no unstarted work.
+    Task* take_from(uthread_taskgroup* g, long* begin, long* end);
+
+    // Returns a Task node, throws std::bad_alloc
+    Task* allocate();
+
+    // Gives back a node returned by allocate
+    void release(Task* t);
+
+private:
+    void unlink(uthread_taskgroup* g);
+
+    uthread_taskgroup* head;
+    uthread_taskgroup* tail;
+    Task* free_tasks;
+};
+
+#endif // TASK_GROUP_H
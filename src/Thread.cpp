@@ -1,48 +1,198 @@
 #include "Thread.h"
 
-#include <setjmp.h>
-#include <signal.h>  // Needed for sigemptyset
+#include <new>
+#include <stdlib.h>
+#include <string.h>
 
-#define STACK_SIZE 4096  // Stack size per thread (in bytes)
+#define THREAD_SLAB_THREADS 64 /* descriptors allocated at once */
 
-#ifdef __x86_64__
-typedef unsigned long address_t;
-#define JB_SP 6
-#define JB_PC 7
-#else
-typedef unsigned int address_t;
-#define JB_SP 4
-#define JB_PC 5
-#endif
+// The scheduler's fields must stay within the first cache lines
+static_assert(offsetof(Thread, rq_index) < THREAD_CACHE_LINE, "Thread hot fields span more than one line");
+static_assert(offsetof(Thread, woken) < 2 * THREAD_CACHE_LINE, "Thread timing fields span more than two lines");
+
+static Thread* free_descriptors = nullptr;  // linked through pool_next
+static char* slab_pos = nullptr;            // unused part of the newest slab
+static size_t slab_left = 0;                // descriptors left in it
+
+void* Thread::operator new(size_t size) {
+    (void)size;  // always sizeof(Thread)
+    if (free_descriptors) {
+        Thread* t = free_descriptors;
+        free_descriptors = t->pool_next;
+        return t;
+    }
+    if (slab_left == 0) {
+        void* slab = nullptr;
+        if (posix_memalign(&slab, THREAD_CACHE_LINE, THREAD_SLAB_THREADS * sizeof(Thread)) != 0) {
+            throw std::bad_alloc();
+        }
+        slab_pos = static_cast<char*>(slab);
+        slab_left = THREAD_SLAB_THREADS;
+    }
+    void* p = slab_pos;
+    slab_pos += sizeof(Thread);
+    slab_left--;
+    return p;
+}
+
+// Slabs are never freed: the descriptor is kept for the next operator new
+void Thread::operator delete(void* p) {
+    if (!p) {
+        return;
+    }
+    Thread* t = static_cast<Thread*>(p);
+    t->pool_next = free_descriptors;
+    free_descriptors = t;
+}
 
 Thread::Thread() :
+        rq_prev(nullptr),
+        rq_next(nullptr),
+        run_queue(nullptr),
         tid(0),
         state(ThreadState::RUNNING),
         total_quantums(1),
+        priority(UTHREAD_PRIORITY_DEFAULT),
+        dynamic_priority(UTHREAD_PRIORITY_DEFAULT),
+        queued_priority(0),
+        sleep_index(-1),
+        rq_index(-1),
+        run_start(0),
+        ready_since(0),
+        wake_at(0),
+        vruntime(0),
+        wait_queue(nullptr),
+        aio(nullptr),
+        chan_wait(nullptr),
+        in_scheduler(0),
+        on_cpu(true),
+        terminate_requested(false),
+        woken(false),
+        quantum_usecs(0),
+        slice_usecs(0),
+        stats(),
+        stack{nullptr, 0},
         entry_point(nullptr),
-        sleep_time(0)
+        start_routine(nullptr),
+        arg(nullptr),
+        result(nullptr),
+        joiners{nullptr, nullptr},
+        pool_next(nullptr),
+        wait_prev(nullptr),
+        wait_next(nullptr),
+        wait_mutex(nullptr),
+        deadline(0),
+        io_fd(-1),
+        io_events(0),
+        io_revents(0),
+        joinable(false),
+        aio_orphaned(false),
+        specific()
 {}
 
-Thread::Thread(int id, thread_entry_point entry) :
+Thread::Thread(int id, thread_entry_point entry, size_t stack_size) :
+        rq_prev(nullptr),
+        rq_next(nullptr),
+        run_queue(nullptr),
         tid(id),
         state(ThreadState::READY),
         total_quantums(0),
+        priority(UTHREAD_PRIORITY_DEFAULT),
+        dynamic_priority(UTHREAD_PRIORITY_DEFAULT),
+        queued_priority(0),
+        sleep_index(-1),
+        rq_index(-1),
+        run_start(0),
+        ready_since(0),
+        wake_at(0),
+        vruntime(0),
+        wait_queue(nullptr),
+        aio(nullptr),
+        chan_wait(nullptr),
+        in_scheduler(1),
+        on_cpu(false),
+        terminate_requested(false),
+        woken(false),
+        quantum_usecs(0),
+        slice_usecs(0),
+        stats(),
+        stack{nullptr, 0},
         entry_point(entry),
-        sleep_time(0)
+        start_routine(nullptr),
+        arg(nullptr),
+        result(nullptr),
+        joiners{nullptr, nullptr},
+        pool_next(nullptr),
+        wait_prev(nullptr),
+        wait_next(nullptr),
+        wait_mutex(nullptr),
+        deadline(0),
+        io_fd(-1),
+        io_events(0),
+        io_revents(0),
+        joinable(false),
+        aio_orphaned(false),
+        specific()
 {
-    address_t sp = (address_t)stack + STACK_SIZE - sizeof(address_t);
-    address_t pc = (address_t)entry_point;
-    sigsetjmp(env, 1);
-    env->__jmpbuf[JB_SP] = translate_address(sp);
-    env->__jmpbuf[JB_PC] = translate_address(pc);
-    sigemptyset(&env->__saved_mask);
+    if (!stack_allocate(&stack, stack_size)) {
+        throw std::bad_alloc();
+    }
+    context_init(&context, stack.base, stack.size, thread_start);
+}
+
+Thread::~Thread() {
+    stack_release(&stack);
 }
 
-Thread::~Thread() = default;
+void Thread::reset(int id, thread_entry_point entry) {
+    rq_prev = nullptr;
+    rq_next = nullptr;
+    run_queue = nullptr;
+    tid = id;
+    state = ThreadState::READY;
+    total_quantums = 0;
+    priority = UTHREAD_PRIORITY_DEFAULT;
+    dynamic_priority = UTHREAD_PRIORITY_DEFAULT;
+    queued_priority = 0;
+    sleep_index = -1;
+    rq_index = -1;
+    run_start = 0;
+    ready_since = 0;
+    wake_at = 0;
+    vruntime = 0;
+    wait_queue = nullptr;
+    aio = nullptr;
+    chan_wait = nullptr;
+    in_scheduler = 1;
+    on_cpu = false;
+    terminate_requested = false;
+    woken = false;
+    quantum_usecs = 0;
+    slice_usecs = 0;
+    stats = uthread_stats_t();
+    entry_point = entry;
+    start_routine = nullptr;
+    arg = nullptr;
+    result = nullptr;
+    joiners.head = nullptr;
+    joiners.tail = nullptr;
+    pool_next = nullptr;
+    wait_prev = nullptr;
+    wait_next = nullptr;
+    wait_mutex = nullptr;
+    deadline = 0;
+    io_fd = -1;
+    io_events = 0;
+    io_revents = 0;
+    joinable = false;
+    aio_orphaned = false;
+    memset(specific, 0, sizeof(specific));
+    context_init(&context, stack.base, stack.size, thread_start);
+}
 
 int Thread::get_quantums() const { return total_quantums; }
-int Thread::get_sleep_time() const { return sleep_time; }
+bool Thread::is_sleeping() const { return sleep_index >= 0; }
+bool Thread::is_waiting() const { return wait_queue != nullptr || io_fd >= 0 || aio != nullptr || chan_wait != nullptr; }
 ThreadState Thread::get_state() const { return state; }
 void Thread::set_quantums(int q) { total_quantums = q; }
-void Thread::set_sleep_time(int t) { sleep_time = t; }
 void Thread::set_state(ThreadState s) { state = s; }
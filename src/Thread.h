@@ -2,20 +2,11 @@
 #ifndef THREAD_H
 #define THREAD_H
 
-#include <setjmp.h>
 #include <signal.h>
 
-#define STACK_SIZE 4096
-
-#ifdef __x86_64__
-typedef unsigned long address_t;
-#define JB_SP 6
-#define JB_PC 7
-#else
-typedef unsigned int address_t;
-#define JB_SP 4
-#define JB_PC 5
-#endif
+#include "Context.h"
+#include "Stack.h"
+#include "uthreads.h"
 
 // Thread state enum for clarity and type safety
 /**
@@ -24,39 +15,115 @@ typedef unsigned int address_t;
 enum class ThreadState {
     RUNNING = 0,
     READY = 1,
-    BLOCKED = 2
+    BLOCKED = 2,
+    TERMINATED = 3  // exited, kept until joined
 };
 
-typedef void (*thread_entry_point)(void);
+void thread_start();  // Declared elsewhere
+
+#define THREAD_CACHE_LINE 64
 
-address_t translate_address(address_t addr);  // Declared elsewhere
+class SchedPolicy;
+struct AioRequest;
 
-class Thread {
+/**
+ * @brief Thread control block.
+ *
+ * Laid out for the scheduler: the first cache line holds what every switch and
+ * ready-queue operation reads (state, priorities, run-queue links and, with
+ * the default context backend, the saved stack pointer), the second the
+ * switch timestamps, the sleep deadline and the wait state. Slice lengths and
+ * statistics follow, then the cold part only touched on spawn, exit, join or
+ * I/O. The cold part shares the allocation rather than living in a separate
+ * array: the scheduler never reads past the hot lines, so it costs no cache
+ * misses there, and the cold fields need no extra indirection. The stack itself
+ * is mapped separately (Stack). Descriptors are cache-line aligned and carved
+ * from contiguous slabs (see operator new).
+ */
+class alignas(THREAD_CACHE_LINE) Thread {
 public:
+    // Hot: first cache line
+#ifdef UTHREADS_CONTEXT_ASM
+    Context context;             // saved stack pointer
+#endif
+    Thread* rq_prev;    // links in a RunQueue
+    Thread* rq_next;
+    SchedPolicy* run_queue;      // queue holding the thread, nullptr when not queued
     int tid;
     ThreadState state;
-    sigjmp_buf env;
-    char stack[STACK_SIZE];
     int total_quantums;
+    int priority;                // base priority, UTHREAD_PRIORITY_MIN .. UTHREAD_PRIORITY_MAX
+    int dynamic_priority;        // priority raised by aging while waiting, reset when it runs
+    int queued_priority;         // level of run_queue the thread is linked in
+    int sleep_index;             // position in its SleepQueue, -1 when not sleeping
+    int rq_index;                // position in a ThreadHeap, for the heap-based policies
+
+    // Hot: second cache line
+    unsigned long long run_start;    // trace_clock() when the thread last started running
+    unsigned long long ready_since;  // trace_clock() when the thread last became READY
+    unsigned long long wake_at;  // absolute wake-up time while sleeping
+    unsigned long long vruntime;     // run time scaled by weight, for UTHREAD_SCHED_FAIR
+    uthread_wait_queue_t* wait_queue;  // queue the thread is parked on, nullptr when not waiting
+    AioRequest* aio;             // asynchronous operation in flight, nullptr when none
+    uthread_chan_t* chan_wait;   // channel the thread is parked receiving on, nullptr when none
+    volatile sig_atomic_t in_scheduler;  // in a library critical section: preemption is deferred
+    bool on_cpu;                 // some worker is executing the thread right now
+    bool terminate_requested;    // terminated while running on another worker
+    bool woken;                  // became READY by a wake-up rather than a preemption or yield
+
+    int quantum_usecs;           // fixed slice set by uthread_set_quantum, 0 for the default
+    int slice_usecs;             // slice adapted to the thread's behavior, 0 until it adapts
+    uthread_stats_t stats;       // updated on every switch
+
+    // Cold
+#ifndef UTHREADS_CONTEXT_ASM
+    Context context;             // sigjmp_buf, too large for the hot lines
+#endif
+    Stack stack;
     thread_entry_point entry_point;
-    int sleep_time;
+    thread_start_routine start_routine;  // used instead of entry_point when set
+    void* arg;                   // argument of start_routine
+    void* result;                // return value of start_routine, for uthread_join
+    uthread_wait_queue_t joiners;  // the thread parked in uthread_join, if any
+    Thread* pool_next;  // link in ThreadPool's free list
+    Thread* wait_prev;           // links in the wait queue of a synchronization object
+    Thread* wait_next;
+    uthread_mutex_t* wait_mutex;       // mutex to reacquire after a condition variable wait
+    unsigned long long deadline; // absolute deadline in monotonic usecs, 0 for none (UTHREAD_SCHED_EDF)
+    int io_fd;                   // fd waited on in the Reactor, -1 when not waiting for I/O
+    int io_events;               // UTHREAD_IO_* events waited for on io_fd
+    int io_revents;              // events found ready, 0 after a timeout
+    bool joinable;               // kept as TERMINATED after exiting, until joined
+    bool aio_orphaned;           // terminated with aio in flight: released once it completes
+    void* specific[UTHREAD_KEYS_MAX];  // uthread_setspecific values, indexed by key
 
     // Constructor for main thread
     Thread();
 
-    // Constructor for other threads
-    Thread(int id, thread_entry_point entry);
+    // Constructor for other threads, throws std::bad_alloc if the stack cannot be mapped
+    Thread(int id, thread_entry_point entry, size_t stack_size = STACK_SIZE);
 
     ~Thread();
 
+    // Descriptors come from cache-line aligned slabs, so that threads created
+    // together are contiguous. A deleted descriptor goes to a free list for the
+    // next spawn; slab memory is kept until the process exits, so its size is
+    // that of the most threads alive at once. Called with the scheduler locked,
+    // or before the workers start. Throws std::bad_alloc.
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+
+    // Reinitializes a pooled thread for a new spawn, keeping its stack
+    void reset(int id, thread_entry_point entry);
+
     // Getters
     int get_quantums() const;
-    int get_sleep_time() const;
+    bool is_sleeping() const;
+    bool is_waiting() const;
     ThreadState get_state() const;
 
     // Setters
     void set_quantums(int q);
-    void set_sleep_time(int t);
     void set_state(ThreadState s);
 };
 
@@ -0,0 +1,64 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool() :
+        free_list(nullptr),
+        idle(0),
+        max_idle(0)
+{}
+
+ThreadPool::~ThreadPool() {
+    clear();
+}
+
+void ThreadPool::set_max_idle(size_t n) {
+    max_idle = n;
+    while (idle > max_idle) {
+        Thread* t = free_list;
+        free_list = t->pool_next;
+        idle--;
+        delete t;
+    }
+}
+
+void ThreadPool::prewarm(size_t count) {
+    if (count > max_idle) {
+        count = max_idle;
+    }
+    while (idle < count) {
+        Thread* t = new Thread(-1, nullptr);
+        t->pool_next = free_list;
+        free_list = t;
+        idle++;
+    }
+}
+
+Thread* ThreadPool::acquire(int id, thread_entry_point entry, size_t stack_size) {
+    if (stack_round_size(stack_size) != stack_round_size(STACK_SIZE) || !free_list) {
+        return new Thread(id, entry, stack_size);
+    }
+    Thread* t = free_list;
+    free_list = t->pool_next;
+    idle--;
+    t->reset(id, entry);
+    return t;
+}
+
+void ThreadPool::release(Thread* t) {
+    if (t->stack.size != stack_round_size(STACK_SIZE) || idle >= max_idle) {
+        delete t;
+        return;
+    }
+    t->pool_next = free_list;
+    free_list = t;
+    idle++;
+}
+
+void ThreadPool::clear() {
+    size_t keep = max_idle;
+    set_max_idle(0);
+    max_idle = keep;
+}
+
+size_t ThreadPool::idle_count() const {
+    return idle;
+}
@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+#include "Thread.h"
+
+/**
+ * @brief Free list of terminated threads kept for reuse, so that spawn and
+ * terminate cost O(1) and no allocation once the pool is warm.
+ *
+ * Only threads whose stack rounds to the default STACK_SIZE are pooled; other
+ * threads are allocated and freed directly.
+ */
+class ThreadPool {
+public:
+    ThreadPool();
+    ~ThreadPool();
+
+    // Sets the number of idle threads kept; excess idle threads are freed
+    void set_max_idle(size_t max_idle);
+
+    // Preallocates up to count idle threads, throws std::bad_alloc on failure
+    void prewarm(size_t count);
+
+    // Returns a READY thread with the given id and entry point, throws std::bad_alloc on failure
+    Thread* acquire(int id, thread_entry_point entry, size_t stack_size);
+
+    // Returns a thread that is no longer referenced by the scheduler
+    void release(Thread* t);
+
+    // Frees every idle thread
+    void clear();
+
+    size_t idle_count() const;
+
+private:
+    Thread* free_list;
+    size_t idle;
+    size_t max_idle;
+};
+
+#endif // THREAD_POOL_H
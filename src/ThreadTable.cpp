@@ -0,0 +1,131 @@
+#include "ThreadTable.h"
+
+#define BITS_PER_WORD 64
+
+static const ThreadSummary EMPTY_SUMMARY = {-1, 0, 0, SLEEP_NONE, 0};
+
+ThreadTable::ThreadTable() :
+        first_free_word(0),
+        summary_count(0),
+        ids_used(0)
+{}
+
+void ThreadTable::reset(size_t capacity) {
+    slots.assign(capacity, nullptr);
+    summaries.reset(new PublishedSummary[capacity]);
+    summary_count = capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        summaries[i].seq.store(0, std::memory_order_relaxed);
+        write_summary(i, EMPTY_SUMMARY);
+    }
+    ids_used.store(capacity > 0 ? 1 : 0, std::memory_order_release);
+    free_ids.assign((capacity + BITS_PER_WORD - 1) / BITS_PER_WORD, ~(uint64_t)0);
+    if (capacity % BITS_PER_WORD != 0) {
+        free_ids.back() = ((uint64_t)1 << (capacity % BITS_PER_WORD)) - 1;
+    }
+    if (!free_ids.empty()) {
+        free_ids[0] &= ~(uint64_t)1;
+    }
+    first_free_word = 0;
+}
+
+size_t ThreadTable::capacity() const {
+    return slots.size();
+}
+
+Thread* ThreadTable::get(int tid) const {
+    if (tid < 0 || (size_t)tid >= slots.size()) {
+        return nullptr;
+    }
+    return slots[tid];
+}
+
+int ThreadTable::allocate_id() {
+    for (size_t w = first_free_word; w < free_ids.size(); w++) {
+        if (free_ids[w] != 0) {
+            int bit = __builtin_ctzll(free_ids[w]);
+            free_ids[w] &= free_ids[w] - 1;
+            first_free_word = w;
+            size_t id = w * BITS_PER_WORD + bit;
+            if (id >= ids_used.load(std::memory_order_relaxed)) {
+                ids_used.store(id + 1, std::memory_order_release);
+            }
+            return (int)id;
+        }
+    }
+    first_free_word = free_ids.size();
+    return -1;
+}
+
+void ThreadTable::set(int tid, Thread* t) {
+    slots[tid] = t;
+}
+
+void ThreadTable::release(int tid) {
+    if (tid < 0 || (size_t)tid >= slots.size()) {
+        return;
+    }
+    slots[tid] = nullptr;
+    write_summary(tid, EMPTY_SUMMARY);
+    if (tid == 0) {
+        return;
+    }
+    size_t w = tid / BITS_PER_WORD;
+    free_ids[w] |= (uint64_t)1 << (tid % BITS_PER_WORD);
+    if (w < first_free_word) {
+        first_free_word = w;
+    }
+}
+
+void ThreadTable::clear() {
+    std::vector<Thread*>().swap(slots);
+    std::vector<uint64_t>().swap(free_ids);
+    first_free_word = 0;
+}
+
+void ThreadTable::publish(const ThreadSummary& s) {
+    if (s.tid >= 0 && (size_t)s.tid < summary_count) {
+        write_summary(s.tid, s);
+    }
+}
+
+/*
+ * Seqlock: the single writer (the scheduler lock holder) makes seq odd, stores
+ * the fields and makes seq even again. A reader retries until it sees the same
+ * even seq before and after loading the fields.
+ */
+void ThreadTable::write_summary(size_t index, const ThreadSummary& s) {
+    PublishedSummary& p = summaries[index];
+    uint32_t seq = p.seq.load(std::memory_order_relaxed);
+    p.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    p.tid.store(s.tid, std::memory_order_relaxed);
+    p.state.store(s.state, std::memory_order_relaxed);
+    p.quantums.store(s.quantums, std::memory_order_relaxed);
+    p.sleep_kind.store(s.sleep_kind, std::memory_order_relaxed);
+    p.wake_at.store(s.wake_at, std::memory_order_relaxed);
+    p.seq.store(seq + 2, std::memory_order_release);
+}
+
+bool ThreadTable::read(int tid, ThreadSummary* out) const {
+    if (tid < 0 || (size_t)tid >= summary_count) {
+        return false;
+    }
+    const PublishedSummary& p = summaries[tid];
+    uint32_t before, after;
+    do {
+        before = p.seq.load(std::memory_order_acquire);
+        out->tid = p.tid.load(std::memory_order_relaxed);
+        out->state = p.state.load(std::memory_order_relaxed);
+        out->quantums = p.quantums.load(std::memory_order_relaxed);
+        out->sleep_kind = p.sleep_kind.load(std::memory_order_relaxed);
+        out->wake_at = p.wake_at.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = p.seq.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+    return out->tid >= 0;
+}
+
+size_t ThreadTable::id_limit() const {
+    return ids_used.load(std::memory_order_acquire);
+}
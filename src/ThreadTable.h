@@ -0,0 +1,96 @@
+#ifndef THREAD_TABLE_H
+#define THREAD_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class Thread;
+
+/**
+ * @brief What other kernel threads may read about a thread without the scheduler lock.
+ */
+struct ThreadSummary {
+    int tid;                  // -1 for a free slot
+    int state;                // UTHREAD_STATE_*
+    int quantums;
+    int sleep_kind;           // SLEEP_NONE, SLEEP_QUANTUMS or SLEEP_USECS
+    unsigned long long wake_at;  // deadline in sleep ticks or micro-seconds, per sleep_kind
+};
+
+enum {
+    SLEEP_NONE = 0,
+    SLEEP_QUANTUMS = 1,
+    SLEEP_USECS = 2
+};
+
+/**
+ * @brief Dense table of live threads indexed by tid, with a bitmap of free ids.
+ *
+ * Lookups are a bounds check and an array load. New ids are always the
+ * smallest free one, found with a find-first-set over the bitmap starting at
+ * the lowest word that may contain a free id. Id 0 is reserved for the main
+ * thread and is never handed out by allocate_id.
+ *
+ * Next to each slot the scheduler publishes a ThreadSummary under a seqlock, so
+ * that observers read tid, state and counters without taking the scheduler lock
+ * and without ever touching a Thread, which may be freed under them.
+ */
+class ThreadTable {
+public:
+    ThreadTable();
+
+    // Sizes the table for ids 0 .. capacity-1 and marks every id except 0 free,
+    // throws std::bad_alloc on failure
+    void reset(size_t capacity);
+
+    size_t capacity() const;
+
+    // Returns the thread with the given tid, or nullptr if there is none
+    Thread* get(int tid) const;
+
+    // Reserves and returns the smallest free id, or -1 if the table is full
+    int allocate_id();
+
+    // Stores t under tid, which must have been reserved (or be 0)
+    void set(int tid, Thread* t);
+
+    // Clears the slot of tid and makes the id available again
+    void release(int tid);
+
+    // Clears every slot and frees the table's memory, except the summaries,
+    // which observers on other kernel threads may still be reading
+    void clear();
+
+    // Stores the summary of thread s.tid; called with the scheduler locked
+    void publish(const ThreadSummary& s);
+
+    // Copies the summary of tid into *out without locking, false if there is no such thread
+    bool read(int tid, ThreadSummary* out) const;
+
+    // Bound on the ids in use, for scanning every summary
+    size_t id_limit() const;
+
+private:
+    struct PublishedSummary {
+        std::atomic<uint32_t> seq;  // odd while being written
+        std::atomic<int> tid;
+        std::atomic<int> state;
+        std::atomic<int> quantums;
+        std::atomic<int> sleep_kind;
+        std::atomic<unsigned long long> wake_at;
+    };
+
+    void write_summary(size_t index, const ThreadSummary& s);
+
+    std::vector<Thread*> slots;
+    std::vector<uint64_t> free_ids;  // bit set = id available
+    size_t first_free_word;          // no free id below this word
+    std::unique_ptr<PublishedSummary[]> summaries;
+    size_t summary_count;
+    std::atomic<size_t> ids_used;    // one past the highest id ever handed out
+};
+
+#endif // THREAD_TABLE_H
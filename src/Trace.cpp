@@ -0,0 +1,179 @@
+#include "Trace.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uthreads.h"
+
+TraceBuffer::TraceBuffer() :
+        events(nullptr),
+        mask(0),
+        recorded(0)
+{}
+
+TraceBuffer::~TraceBuffer() {
+    delete[] events;
+}
+
+void TraceBuffer::reset(size_t capacity) {
+    delete[] events;
+    events = nullptr;
+    mask = 0;
+    recorded = 0;
+    if (capacity == 0) {
+        return;
+    }
+    size_t rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+    events = new TraceEvent[rounded];
+    mask = rounded - 1;
+}
+
+size_t TraceBuffer::size() const {
+    if (!events) {
+        return 0;
+    }
+    return recorded > mask ? mask + 1 : (size_t)recorded;
+}
+
+const TraceEvent& TraceBuffer::at(size_t i) const {
+    uint64_t first = recorded > mask ? recorded - (mask + 1) : 0;
+    return events[(first + i) & mask];
+}
+
+#define CALIBRATION_USECS 1000 /* shortest interval trace_cycles_per_usec measures over */
+#define JSON_BUFFER_SIZE 4096
+
+static uint64_t base_cycles = 0;
+static uint64_t base_usecs = 0;
+
+static uint64_t monotonic_usecs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void trace_clock_init() {
+    base_usecs = monotonic_usecs();
+    base_cycles = trace_clock();
+}
+
+double trace_cycles_per_usec() {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t usecs = monotonic_usecs() - base_usecs;
+    if (usecs < CALIBRATION_USECS) {
+        struct timespec pause = {0, (long)(CALIBRATION_USECS - usecs) * 1000L};
+        nanosleep(&pause, nullptr);
+        usecs = monotonic_usecs() - base_usecs;
+    }
+    return (double)(trace_clock() - base_cycles) / (double)usecs;
+#else
+    return 1000.0;
+#endif
+}
+
+uint64_t trace_clock_base() {
+    return base_cycles;
+}
+
+namespace {
+
+/**
+ * Buffered writer of the JSON text, through a fixed buffer on the stack.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(int fd) : fd(fd), used(0), failed(false) {}
+
+    void append(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        for (int attempt = 0; attempt < 2 && !failed; attempt++) {
+            va_list args;
+            va_start(args, format);
+            int n = vsnprintf(buffer + used, sizeof(buffer) - used, format, args);
+            va_end(args);
+            if (n >= 0 && (size_t)n < sizeof(buffer) - used) {
+                used += n;
+                return;
+            }
+            flush();
+        }
+        failed = true;
+    }
+
+    bool flush() {
+        size_t done = 0;
+        while (!failed && done < used) {
+            ssize_t n = write(fd, buffer + done, used - done);
+            if (n < 0 && errno != EINTR) {
+                failed = true;
+            } else if (n > 0) {
+                done += n;
+            }
+        }
+        used = 0;
+        return !failed;
+    }
+
+private:
+    int fd;
+    size_t used;
+    bool failed;
+    char buffer[JSON_BUFFER_SIZE];
+};
+
+const char* const switch_reason_names[UTHREAD_SWITCH_REASONS] = {
+    "preempt", "yield", "block", "sleep", "wait", "terminate"
+};
+
+const char* switch_reason_name(int reason) {
+    return reason >= 0 && reason < UTHREAD_SWITCH_REASONS ? switch_reason_names[reason] : "switch";
+}
+
+} // namespace
+
+bool trace_write_json(int fd, const std::vector<TraceEvent>* workers, size_t num_workers, uint64_t now,
+                      double cycles_per_usec) {
+    JsonWriter out(fd);
+    int pid = (int)getpid();
+    double scale = cycles_per_usec > 0 ? 1.0 / cycles_per_usec : 0;
+    auto usecs = [&](uint64_t time) { return (double)(time - base_cycles) * scale; };
+    const char* separator = "";
+    out.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (size_t w = 0; w < num_workers; w++) {
+        // Each switch ends the slice of the thread that leaves the CPU and opens
+        // the one of the thread that takes it
+        int running = -1;
+        uint64_t since = 0;
+        for (const TraceEvent& e : workers[w]) {
+            if (e.type == TRACE_WAKE) {
+                out.append("%s\n{\"name\":\"wake\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+                           "\"args\":{\"worker\":%zu,\"by\":%d}}",
+                           separator, pid, e.tid, usecs(e.time), w, e.other);
+                separator = ",";
+                continue;
+            }
+            if (running >= 0 && running == e.tid) {
+                out.append("%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                           "\"args\":{\"worker\":%zu}}",
+                           separator, switch_reason_name(e.reason), pid, e.tid, usecs(since),
+                           (double)(e.time - since) * scale, w);
+                separator = ",";
+            }
+            running = e.other;
+            since = e.time;
+        }
+        if (running >= 0) {
+            out.append("%s\n{\"name\":\"running\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                       "\"args\":{\"worker\":%zu}}",
+                       separator, pid, running, usecs(since), (double)(now - since) * scale, w);
+            separator = ",";
+        }
+    }
+    out.append("\n]}\n");
+    return out.flush();
+}
@@ -0,0 +1,108 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/**
+ * @brief Timestamp for scheduler statistics: the TSC where there is one, so
+ * that reading it costs a few cycles, and nanoseconds elsewhere.
+ */
+static inline uint64_t trace_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Records the starting point from which trace_cycles_per_usec measures the clock rate.
+ */
+void trace_clock_init();
+
+/**
+ * @brief trace_clock() ticks per micro-second, measured since trace_clock_init.
+ * May sleep briefly right after trace_clock_init, so never call it with the scheduler locked.
+ */
+double trace_cycles_per_usec();
+
+/**
+ * @brief trace_clock() value at trace_clock_init, the zero of dumped timestamps.
+ */
+uint64_t trace_clock_base();
+
+enum TraceEventType {
+    TRACE_SWITCH = 0,  // tid left the CPU for reason, other started running
+    TRACE_WAKE = 1     // tid became READY after waiting, other (-1 if none) woke it
+};
+
+struct TraceEvent {
+    uint64_t time;     // trace_clock() value
+    int32_t tid;
+    int32_t other;
+    uint8_t type;      // TraceEventType
+    uint8_t reason;    // UTHREAD_SWITCH_* for TRACE_SWITCH
+};
+
+/**
+ * @brief Fixed-size ring of the most recent scheduler events of one worker.
+ *
+ * Only the owning worker records, with the scheduler locked, and the oldest
+ * events are overwritten once the ring is full, so recording is a handful of
+ * stores with no atomic operation. Readers take the scheduler lock.
+ */
+class TraceBuffer {
+public:
+    TraceBuffer();
+    ~TraceBuffer();
+
+    // Allocates room for capacity events (rounded up to a power of two), 0
+    // disables recording. Throws std::bad_alloc.
+    void reset(size_t capacity);
+
+    bool enabled() const { return events != nullptr; }
+
+    void record(uint64_t time, TraceEventType type, int tid, int other, int reason) {
+        if (!events) {
+            return;
+        }
+        TraceEvent& e = events[recorded & mask];
+        e.time = time;
+        e.tid = tid;
+        e.other = other;
+        e.type = (uint8_t)type;
+        e.reason = (uint8_t)reason;
+        recorded++;
+    }
+
+    // Number of events held, at most the capacity
+    size_t size() const;
+
+    // i-th held event, oldest first
+    const TraceEvent& at(size_t i) const;
+
+private:
+    TraceEvent* events;
+    size_t mask;
+    uint64_t recorded;  // events ever recorded
+};
+
+/**
+ * @brief Writes the events of workers[0 .. num_workers-1], each oldest first, to fd as Chrome
+ * trace-event JSON. Run slices still open at now end there.
+ * @return false if writing to fd failed.
+ */
+bool trace_write_json(int fd, const std::vector<TraceEvent>* workers, size_t num_workers, uint64_t now,
+                      double cycles_per_usec);
+
+#endif // TRACE_H
@@ -0,0 +1,53 @@
+#include "WaitQueue.h"
+
+#include "Thread.h"
+
+void wait_queue_init(uthread_wait_queue_t* q) {
+    q->head = nullptr;
+    q->tail = nullptr;
+}
+
+bool wait_queue_empty(const uthread_wait_queue_t* q) {
+    return q->head == nullptr;
+}
+
+void wait_queue_push(uthread_wait_queue_t* q, Thread* t) {
+    Thread* tail = (Thread*)q->tail;
+    t->wait_prev = tail;
+    t->wait_next = nullptr;
+    if (tail) {
+        tail->wait_next = t;
+    } else {
+        q->head = t;
+    }
+    q->tail = t;
+    t->wait_queue = q;
+}
+
+Thread* wait_queue_pop(uthread_wait_queue_t* q) {
+    Thread* t = (Thread*)q->head;
+    if (t) {
+        wait_queue_remove(t);
+    }
+    return t;
+}
+
+void wait_queue_remove(Thread* t) {
+    uthread_wait_queue_t* q = t->wait_queue;
+    if (!q) {
+        return;
+    }
+    if (t->wait_prev) {
+        t->wait_prev->wait_next = t->wait_next;
+    } else {
+        q->head = t->wait_next;
+    }
+    if (t->wait_next) {
+        t->wait_next->wait_prev = t->wait_prev;
+    } else {
+        q->tail = t->wait_prev;
+    }
+    t->wait_prev = nullptr;
+    t->wait_next = nullptr;
+    t->wait_queue = nullptr;
+}
@@ -0,0 +1,38 @@
+#ifndef WAIT_QUEUE_H
+#define WAIT_QUEUE_H
+
+#include "uthreads.h"
+
+class Thread;
+
+/*
+ * Operations on a uthread_wait_queue_t: the FIFO of threads parked on a
+ * mutex, condition variable or semaphore. The queue head lives in the user's
+ * synchronization object and the links in the threads (Thread::wait_prev /
+ * wait_next), so parking never allocates and every operation is O(1). A
+ * thread is parked on at most one queue at a time (Thread::wait_queue).
+ */
+
+/**
+ * @brief Makes q an empty queue.
+ */
+void wait_queue_init(uthread_wait_queue_t* q);
+
+bool wait_queue_empty(const uthread_wait_queue_t* q);
+
+/**
+ * @brief Appends t, which must not be parked on any queue, to the back of q.
+ */
+void wait_queue_push(uthread_wait_queue_t* q, Thread* t);
+
+/**
+ * @brief Removes and returns the oldest thread of q, or nullptr if q is empty.
+ */
+Thread* wait_queue_pop(uthread_wait_queue_t* q);
+
+/**
+ * @brief Unlinks t from the queue it is parked on, if any.
+ */
+void wait_queue_remove(Thread* t);
+
+#endif // WAIT_QUEUE_H
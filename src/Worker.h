@@ -0,0 +1,48 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <atomic>
+
+#include "PreemptionTimer.h"
+#include "SchedPolicy.h"
+#include "Thread.h"
+#include "Trace.h"
+
+/**
+ * @brief Per kernel thread scheduler state.
+ *
+ * With a single worker (the default) this is the only scheduler and it runs on
+ * the thread that called uthread_init. With several workers each one owns a
+ * kernel thread and a local run queue, and steals from the others when its
+ * own queue is empty.
+ */
+struct Worker {
+    int index;
+    pthread_t kernel_thread;
+    Thread* current;           // thread executing on this worker
+    Thread* idle;              // scheduler loop context, nullptr with a single worker
+    Thread* should_terminate;  // thread to finalize once we are off its stack
+    SchedPolicy* ready_queue;  // READY threads, ordered by the UTHREAD_SCHED_* policy
+    PreemptionTimer timer;
+    int armed_usecs;                        // interval the timer was last armed with, 0 while paused
+    volatile sig_atomic_t preempt_pending;  // quantum expired while current->in_scheduler was set
+    std::atomic<unsigned long> switches;    // context switches so far, with several workers, see running_thread
+    TraceBuffer trace;                      // recent scheduler events, recorded only on this worker
+
+    explicit Worker(int i) :
+            index(i),
+            kernel_thread(),
+            current(nullptr),
+            idle(nullptr),
+            should_terminate(nullptr),
+            ready_queue(nullptr),
+            armed_usecs(0),
+            preempt_pending(0),
+            switches(0)
+    {}
+};
+
+#endif // WORKER_H
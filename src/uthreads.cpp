@@ -1,47 +1,44 @@
 #include <stdio.h>
-#include <setjmp.h>
 #include <signal.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
 #include "uthreads.h"
-#include <queue>
-#include <set>
-#include <map>
+#include <atomic>
 #include <iostream>
-#include "Thread.h" 
-
-#ifdef __x86_64__
-typedef unsigned long address_t;
-#define JB_SP 6
-#define JB_PC 7
-address_t translate_address(address_t addr)
-{
-    address_t ret;
-    asm volatile("xor    %%fs:0x30,%0\n"
-                 "rol    $0x11,%0\n"
-                 : "=g" (ret)
-                 : "0" (addr));
-    return ret;
-}
-#else
-typedef unsigned int address_t;
-#define JB_SP 4
-#define JB_PC 5
-address_t translate_address(address_t addr)
-{
-    address_t ret;
-    asm volatile("xor    %%gs:0x18,%0\n"
-                 "rol    $0x9,%0\n"
-            : "=g" (ret)
-            : "0" (addr));
-    return ret;
-}
-#endif
+#include <vector>
+#include "Thread.h"
+#include "ThreadPool.h"
+#include "SchedPolicy.h"
+#include "SleepQueue.h"
+#include "WaitQueue.h"
+#include "ThreadTable.h"
+#include "SpinLock.h"
+#include "Worker.h"
+#include "PreemptionTimer.h"
+#include "Reactor.h"
+#include "AsyncIo.h"
+#include "Channel.h"
+#include "Coroutine.h"
+#include "TaskGroup.h"
+#include "Trace.h"
 
 #define SUCCESS 0
 #define FAILURE -1
 
+#define IDLE_STACK_SIZE 16384 /* stack of the first worker's scheduler loop */
+#define IDLE_SPINS 64 /* empty polls before an idle worker starts sleeping */
+#define IDLE_SLEEP_NSECS 50000
+#define CHAN_MAX_CAPACITY ((size_t)1 << 30)
+#define PARALLEL_FOR_CHUNKS_PER_THREAD 4 /* chunks per thread when uthread_parallel_for picks the grain */
+#define CORO_CARRIER_STACK_SIZE 65536 /* stack the coroutines run on */
+#define ADAPTIVE_QUANTUM_RANGE 4 /* adaptive slices stay within quantum / 4 .. quantum * 4 */
+
 #define THREAD_LIBRARY_ERROR(msg) \
     fprintf(stderr, "thread library error: %s\n", msg)
 
@@ -49,368 +46,2550 @@ address_t translate_address(address_t addr)
     fprintf(stderr, "system error: %s\n", msg)
 
 // ================== Global Variables =====================
-static int total_quantums = 0;
-static struct itimerval timer = {0};
-Thread* current_thread = nullptr;
+volatile int uthread_inline_tid = -1;
+volatile int uthread_inline_total_quantums = 0;
 int quantum_duration = 0;
-Thread* should_terminate = nullptr;
+int timer_mode = UTHREAD_TIMER_PROCESS;
+int aging_interval = 0;
+int sched_policy = UTHREAD_SCHED_RR;
+bool adaptive_quantum = false;
 bool end_process = false;
 int exit_status = 0;
-std::queue<Thread*> ready_queue;
-std::set<Thread*> sleeping_threads;
-std::priority_queue<int> available_ids;
-std::map<int, Thread*> all_threads;
+SleepQueue quantum_sleepers;
+SleepQueue usec_sleepers;
+std::atomic<unsigned long long> sleep_ticks(0);  // atomic only for lock-free readers, see uthread_snapshot
+ThreadTable all_threads;
+ThreadPool thread_pool;
+Reactor reactor;
+AsyncIo async_io;
+int aio_backend = UTHREAD_AIO_URING;
+Doorbell doorbell;
+size_t parked_receivers = 0;
+TaskQueue task_queue;
+uthread_wait_queue_t idle_helpers = {nullptr, nullptr};  // task helpers with nothing to run
+int task_helpers = 0;
+int max_task_helpers = 1;
+FrameArena frame_arena;
+CoroQueue coro_ready;            // coroutines the carrier resumes next, oldest first
+CoroSleepQueue coro_sleepers;
+CoroPoller coro_poller;
+Thread* coro_carrier = nullptr;  // thread that runs the coroutines, spawned on first use
+bool coro_carrier_parked = false;
+uthread_wait_queue_t coro_carrier_idle = {nullptr, nullptr};
+std::vector<Worker*> workers;
+bool multi_worker = false;
+SpinLock scheduler_spinlock;
+static thread_local Worker* this_worker = nullptr;
+static Thread* volatile current_thread = nullptr;  // thread running on the only worker, nullptr with several workers
+static void (*key_destructors[UTHREAD_KEYS_MAX])(void*);
+static bool key_in_use[UTHREAD_KEYS_MAX];
 sigset_t blocked_sets;
-#define BLOCK_TIMER_SIGNAL sigprocmask(SIG_BLOCK, &blocked_sets, nullptr)
-#define UNBLOCK_TIMER_SIGNAL sigprocmask(SIG_UNBLOCK, &blocked_sets, nullptr)
+
+void switch_thread();
+static void park_current(uthread_wait_queue_t* q);
+static void wake_waiter(Thread* t);
+static void make_ready(Worker* w, Thread* t, bool woken, unsigned long long now = trace_clock());
+
+/**
+ * Worker of the calling kernel thread.
+ * A thread may resume on another worker after a switch, so the result must be
+ * fetched again after every switch; the asm keeps the compiler from caching it.
+ */
+__attribute__((noinline)) static Worker* local_worker() {
+    asm volatile("");
+    return this_worker;
+}
+
+/**
+ * Thread running on the calling kernel thread, read without the scheduler
+ * lock: a single load with one worker. With several workers the caller may be
+ * preempted between loading its worker and the worker's current thread, and
+ * resume on another worker, so the read is repeated until it was made on the
+ * same worker with no switch on it in between (Worker::switches): the caller
+ * was then running there when current was loaded.
+ */
+static inline Thread* running_thread() {
+    Thread* t = current_thread;
+    if (t) {
+        return t;
+    }
+    while (true) {
+        Worker* w = local_worker();
+        unsigned long switches = w->switches.load(std::memory_order_acquire);
+        t = __atomic_load_n(&w->current, __ATOMIC_ACQUIRE);
+        if (local_worker() == w && w->switches.load(std::memory_order_acquire) == switches) {
+            return t;
+        }
+    }
+}
+
+/*
+ * Critical sections set the running thread's in_scheduler flag instead of
+ * masking the timer signal, so entering and leaving them costs no system call.
+ * A quantum that expires inside one is only recorded on the worker, and the
+ * preemption happens when the critical section ends. The flag belongs to the
+ * thread rather than the worker, so that a thread preempted and moved to
+ * another worker just before setting it still sets the one the timer handler
+ * of its new worker checks. With several workers critical sections also take
+ * the scheduler lock. A context switch keeps both held: the thread switched to
+ * was itself switched out inside a critical section (or starts in one, see
+ * thread_start) and releases them.
+ */
+#define SCHEDULER_LOCK scheduler_lock()
+#define SCHEDULER_UNLOCK scheduler_unlock()
+
+static inline void scheduler_lock() {
+    running_thread()->in_scheduler = 1;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (multi_worker) {
+        scheduler_spinlock.lock();
+    }
+}
+
+static inline void scheduler_unlock() {
+    // Still in the critical section, so the caller cannot have moved
+    Worker* w = local_worker();
+    Thread* self = w->current;
+    if (multi_worker) {
+        scheduler_spinlock.unlock();
+    }
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    self->in_scheduler = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (w->preempt_pending) {
+        switch_thread();
+    }
+}
 
 /**
  * Clean up all threads and exit the process.
  * @param exit_code Exit status code.
  */
 void clean_and_exit(int exit_code = 0) {
-    for (auto& pair : all_threads) {
-        if (pair.first != 0) {
-            delete pair.second;
-            pair.second = nullptr;
+    // With several workers other kernel threads may still be running on these
+    // stacks, so they are left for the process exit to reclaim.
+    if (!multi_worker && !workers.empty()) {
+        Thread* running = workers[0]->current;
+        for (size_t tid = 1; tid < all_threads.capacity(); tid++) {
+            Thread* t = all_threads.get((int)tid);
+            // The running thread's stack is still in use until exit, and so
+            // are the stacks that asynchronous operations complete into
+            if (t && t != running && !t->aio) {
+                delete t;
+            }
         }
+        delete all_threads.get(0);
+        workers[0]->current = nullptr;
+        all_threads.clear();
+        thread_pool.clear();
     }
-    if (current_thread) {
-        delete current_thread;
-        current_thread = nullptr;
-    }
-    all_threads.clear();
     exit(exit_code);
 }
 
 /**
- * Reset the virtual timer for thread quantums.
- * @param usecs Quantum duration in microseconds.
+ * Length of t's next slice: its own quantum if uthread_set_quantum gave it
+ * one, else its adapted slice, else the global quantum.
  */
-void reset_timer(int usecs) {
-    timer.it_value.tv_sec = 0;
-    timer.it_value.tv_usec = usecs;
-    timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = usecs;
-    if (setitimer(ITIMER_VIRTUAL, &timer, nullptr) == -1) {
-        SYSTEM_ERROR("setitimer failed");
-        exit_status = 1;
-        uthread_terminate(0);
+static int slice_usecs(const Thread* t) {
+    if (t->quantum_usecs > 0) {
+        return t->quantum_usecs;
     }
+    if (t->slice_usecs > 0) {
+        return t->slice_usecs;
+    }
+    return quantum_duration;
 }
 
 /**
- * Update all sleeping threads, waking those whose sleep time is over.
+ * Adaptive quantum: a thread preempted at the end of its slice gets a slice
+ * twice as long, up to ADAPTIVE_QUANTUM_RANGE quanta, so that CPU-bound
+ * threads switch less; one that stops running before its slice ends gets one
+ * half as long, down to a quantum / ADAPTIVE_QUANTUM_RANGE. Yields and exits
+ * leave the slice alone.
  */
-void update_sleeping_threads() {
-    std::vector<Thread*> to_wake;
-    for (auto* thread : sleeping_threads) {
-        thread->set_sleep_time(thread->get_sleep_time() - 1);
-        if (thread->get_sleep_time() == 0) {
-            to_wake.push_back(thread);
+static void adapt_slice(Thread* t, int reason) {
+    long long slice = slice_usecs(t);
+    if (reason == UTHREAD_SWITCH_PREEMPT) {
+        long long longest = (long long)quantum_duration * ADAPTIVE_QUANTUM_RANGE;
+        slice = slice * 2 < longest ? slice * 2 : longest;
+        t->slice_usecs = slice < INT_MAX ? (int)slice : INT_MAX;
+    } else if (reason == UTHREAD_SWITCH_BLOCK || reason == UTHREAD_SWITCH_SLEEP || reason == UTHREAD_SWITCH_WAIT) {
+        long long shortest = quantum_duration / ADAPTIVE_QUANTUM_RANGE;
+        if (shortest < 1) {
+            shortest = 1;
         }
+        t->slice_usecs = (int)(slice / 2 > shortest ? slice / 2 : shortest);
     }
-    for (auto* thread : to_wake) {
-        sleeping_threads.erase(thread);
-        if (thread->get_state() != ThreadState::BLOCKED) {
-            ready_queue.push(thread);
+}
+
+static unsigned long long monotonic_usecs();
+
+/**
+ * Interval to arm the timer with for t's slice. Micro-second sleepers are only
+ * woken when the scheduler runs, so a slice grown past the quantum is cut short
+ * at the earliest sleeper's deadline, though never below a quantum.
+ */
+static int timer_usecs(const Thread* t) {
+    int usecs = slice_usecs(t);
+    if (adaptive_quantum && usecs > quantum_duration) {
+        Thread* first = usec_sleepers.front();
+        if (first) {
+            unsigned long long now = monotonic_usecs();
+            unsigned long long until = first->wake_at > now ? first->wake_at - now : 0;
+            if (until < (unsigned long long)usecs) {
+                usecs = until > (unsigned long long)quantum_duration ? (int)until : quantum_duration;
+            }
         }
     }
+    return usecs;
 }
 
 /**
- * Finalize and clean up a thread marked for termination.
+ * Restart the preemption timer of a worker for a full slice of its current
+ * thread.
+ * @param w Worker whose timer is re-armed.
  */
-void finalize_terminated_thread() {
-    int tid = should_terminate->tid;
-    delete should_terminate;
-    should_terminate = nullptr;
-    all_threads.erase(tid);
-    available_ids.push(-tid);
-    reset_timer(quantum_duration);
+void reset_timer(Worker* w) {
+    int usecs = timer_usecs(w->current);
+    if (!w->timer.arm(usecs)) {
+        SYSTEM_ERROR("timer arming failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    w->armed_usecs = usecs;
 }
 
-static void enqueue_current_if_needed() {
-    if (!should_terminate && current_thread->sleep_time <= 0) {
-        current_thread->set_state(ThreadState::READY);
-        ready_queue.push(current_thread);
+/**
+ * Stop a per-worker timer while the worker idles, so that it does not keep
+ * firing into a masked signal. The process-wide timer keeps running for the
+ * other workers.
+ */
+static void pause_timer(Worker* w) {
+    if (timer_mode != UTHREAD_TIMER_PROCESS && !w->timer.disarm()) {
+        SYSTEM_ERROR("timer disarming failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
     }
+    w->armed_usecs = 0;
 }
 
-static void handle_end_process() {
-    if (end_process && current_thread->tid == 0) {
-        while (!ready_queue.empty()) ready_queue.pop();
-        sleeping_threads.clear();
-        while (!available_ids.empty()) available_ids.pop();
-        clean_and_exit(0);
+/**
+ * UTHREAD_STATE_* value of t.
+ */
+static int public_state(const Thread* t) {
+    switch (t->get_state()) {
+        case ThreadState::TERMINATED:
+            return UTHREAD_STATE_TERMINATED;
+        case ThreadState::BLOCKED:
+            return UTHREAD_STATE_BLOCKED;
+        case ThreadState::READY:
+            return UTHREAD_STATE_READY;
+        case ThreadState::RUNNING:
+            break;
+    }
+    // A parked or sleeping thread keeps the RUNNING state it left the CPU in
+    if (t->is_waiting()) {
+        return UTHREAD_STATE_WAITING;
     }
+    return t->is_sleeping() ? UTHREAD_STATE_SLEEPING : UTHREAD_STATE_RUNNING;
 }
 
-static void handle_should_terminate() {
-    if (should_terminate) {
-        finalize_terminated_thread();
+/**
+ * Publish the state, quantums and sleep deadline of t for the lock-free
+ * readers (uthread_get_quantums, uthread_get_state, uthread_snapshot). Called
+ * wherever they change: on every switch, when a thread becomes READY, blocks
+ * without running or exits.
+ */
+static void publish(const Thread* t) {
+    ThreadSummary summary;
+    summary.tid = t->tid;
+    summary.state = public_state(t);
+    summary.quantums = t->get_quantums();
+    summary.sleep_kind = SLEEP_NONE;
+    if (quantum_sleepers.contains(t)) {
+        summary.sleep_kind = SLEEP_QUANTUMS;
+    } else if (usec_sleepers.contains(t)) {
+        summary.sleep_kind = SLEEP_USECS;
     }
+    summary.wake_at = t->wake_at;
+    all_threads.publish(summary);
 }
 
 /**
- * Switch context to the next ready thread.
- * Handles sleeping, termination, and process end.
+ * Queue t, which just became READY, on w. A woken thread is returning from
+ * blocking, sleeping or waiting rather than being preempted or yielding; its
+ * wake-up latency is measured when it next runs.
  */
-void switch_thread() {
-    BLOCK_TIMER_SIGNAL;
-    update_sleeping_threads();
-    enqueue_current_if_needed();  
-    if (ready_queue.empty()) {
-        UNBLOCK_TIMER_SIGNAL;
-        return;
-    }
-    Thread* prev = current_thread;
-    current_thread = ready_queue.front();
-    ready_queue.pop();
-    current_thread->set_state(ThreadState::RUNNING);
-    current_thread->set_quantums(current_thread->get_quantums() + 1);
-    total_quantums++;
-    if (!should_terminate) {
-        if (sigsetjmp(prev->env, 1) == 0) {
-            reset_timer(quantum_duration);
-            UNBLOCK_TIMER_SIGNAL;
-            siglongjmp(current_thread->env, 1);
+static void make_ready(Worker* w, Thread* t, bool woken, unsigned long long now) {
+    t->set_state(ThreadState::READY);
+    t->ready_since = now;
+    t->woken = woken;
+    if (woken) {
+        w->trace.record(now, TRACE_WAKE, t->tid, w->current ? w->current->tid : -1, 0);
+        // Adaptive quantum: a thread that keeps blocking early runs ahead of its equals, until it runs.
+        // Only the round-robin queue reads dynamic_priority; FAIR and EDF order threads their own way.
+        if (adaptive_quantum && sched_policy == UTHREAD_SCHED_RR && t->slice_usecs > 0 && t->slice_usecs < quantum_duration &&
+            t->dynamic_priority == t->priority && t->priority < UTHREAD_PRIORITY_MAX) {
+            t->dynamic_priority = t->priority + 1;
         }
-        else {
-            handle_end_process();
-            handle_should_terminate();
+    }
+    w->ready_queue->enqueue(t);
+    publish(t);
+}
+
+/**
+ * Current CLOCK_MONOTONIC time in microseconds.
+ */
+static unsigned long long monotonic_usecs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void wake_expired(Worker* w, SleepQueue& sleepers, unsigned long long now) {
+    Thread* thread;
+    while ((thread = sleepers.pop_expired(now)) != nullptr) {
+        // An I/O wait that timed out
+        reactor.remove(thread);
+        if (thread->get_state() != ThreadState::BLOCKED) {
+            make_ready(w, thread, true);
+        } else {
+            publish(thread);
         }
     }
-    else {
-        UNBLOCK_TIMER_SIGNAL;
-        siglongjmp(current_thread->env, 1);
+}
+
+/**
+ * Advance the sleep clock by one quantum and wake the threads that are due.
+ * Costs O(expired * log sleepers), independent of the number of sleepers.
+ */
+void update_sleeping_threads(Worker* w) {
+    unsigned long long ticks = sleep_ticks.load(std::memory_order_relaxed) + 1;
+    sleep_ticks.store(ticks, std::memory_order_relaxed);
+    wake_expired(w, quantum_sleepers, ticks);
+    if (!usec_sleepers.empty()) {
+        wake_expired(w, usec_sleepers, monotonic_usecs());
     }
-    UNBLOCK_TIMER_SIGNAL;
 }
 
-void timer_handler(int sig) {
-    switch_thread();
+static void remove_from_sleepers(Thread* t) {
+    quantum_sleepers.remove(t);
+    usec_sleepers.remove(t);
 }
 
-void free_memory(){
-    for (auto& pair : all_threads) {
-        delete pair.second;
+static void remove_from_ready_queue(Thread* t) {
+    if (t->run_queue) {
+        t->run_queue->dequeue(t);
     }
-    all_threads.clear();
-    while (!ready_queue.empty()) ready_queue.pop();
-    sleeping_threads.clear();
-    while (!available_ids.empty()) available_ids.pop();
 }
 
-static void init_signal_mask() {
-    if (sigemptyset(&blocked_sets) == -1) {
-        SYSTEM_ERROR("sigemptyset failed");
+static void wake_io_waiter(Thread* t) {
+    remove_from_sleepers(t);
+    wake_waiter(t);
+}
+
+/**
+ * Hand the queued asynchronous operations to the kernel.
+ */
+static void flush_aio() {
+    if (!async_io.flush()) {
+        SYSTEM_ERROR("io_uring_enter failed");
         exit_status = 1;
         clean_and_exit(exit_status);
     }
-    if (sigaddset(&blocked_sets, SIGVTALRM) == -1) {
-        SYSTEM_ERROR("sigaddset failed");
-        exit_status = 1;
-        clean_and_exit(exit_status);
+}
+
+static void complete_aio(AioRequest* req) {
+    Thread* t = req->thread;
+    t->aio = nullptr;
+    if (t->aio_orphaned) {
+        thread_pool.release(t);
+        return;
     }
+    wake_waiter(t);
 }
 
-static void init_available_ids() {
-    for (int i = 1; i < MAX_THREAD_NUM; i++) {
-        available_ids.push(-i);
+/**
+ * Wake the threads whose asynchronous operations have completed.
+ */
+static void reap_aio() {
+    if (async_io.in_flight()) {
+        async_io.reap(complete_aio);
     }
 }
 
-static void init_main_thread() {
-    try {
-        current_thread = new Thread();
-    } catch (const std::bad_alloc& e) {
-        SYSTEM_ERROR("Thread creation failed");
-        UNBLOCK_TIMER_SIGNAL;
-        exit_status = 1;
-        clean_and_exit(exit_status);
+/**
+ * Wake the receiver parked on ch, if any.
+ */
+static void wake_receiver(uthread_chan* ch) {
+    Thread* t = ch->receiver;
+    if (t && t->chan_wait == ch) {
+        t->chan_wait = nullptr;
+        parked_receivers--;
+        wake_waiter(t);
     }
-    all_threads[0] = current_thread;
 }
 
-static void setup_timer_handler() {
-    struct sigaction sa = {0};
-    sa.sa_handler = &timer_handler;
-    if (sigaction(SIGVTALRM, &sa, nullptr) == -1) {
-        SYSTEM_ERROR("sigaction failed");
+/**
+ * Stop a parked receiver from waiting on its channel.
+ */
+static void cancel_receive(Thread* t) {
+    uthread_chan* ch = t->chan_wait;
+    if (ch) {
+        ch->disarm();
+        ch->receiver = nullptr;
+        t->chan_wait = nullptr;
+        parked_receivers--;
+    }
+}
+
+/**
+ * Wake the receivers of the channels that threads outside the library sent to.
+ */
+static void answer_doorbell() {
+    if (doorbell.pending()) {
+        doorbell.drain(wake_receiver);
+    }
+}
+
+/**
+ * Wake the threads whose fds are ready, waiting up to timeout_ms for one.
+ */
+static void poll_io(int timeout_ms) {
+    if (reactor.poll(timeout_ms, wake_io_waiter) < 0 && errno != EINTR) {
+        SYSTEM_ERROR("epoll_wait failed");
         exit_status = 1;
         clean_and_exit(exit_status);
     }
 }
 
-int uthread_init(int quantum_usecs) {
-    BLOCK_TIMER_SIGNAL;
-    end_process = false;
-    should_terminate = nullptr;
-    exit_status = 0;
+/**
+ * Thread with ID tid, or nullptr if it does not exist or has already terminated.
+ */
+static Thread* live_thread(int tid) {
+    Thread* t = all_threads.get(tid);
+    return t && t->get_state() != ThreadState::TERMINATED ? t : nullptr;
+}
 
-    init_signal_mask();
-    if (quantum_usecs <= 0) {
-        THREAD_LIBRARY_ERROR("Invalid quantum value");
-        return FAILURE;
+/**
+ * Free the ID of a terminated thread and return it to the pool.
+ */
+static void reap_thread(Thread* t) {
+    int tid = t->tid;
+    if (t->aio) {
+        // Its stack is in use until the operation completes, see complete_aio
+        t->aio_orphaned = true;
+    } else {
+        thread_pool.release(t);
     }
-    total_quantums = 1;
-    quantum_duration = quantum_usecs;
-    init_available_ids();
-    init_main_thread();
-    setup_timer_handler();
-    reset_timer(quantum_duration);
-    UNBLOCK_TIMER_SIGNAL;
-    return SUCCESS;
+    all_threads.release(tid);
 }
 
-int uthread_spawn(thread_entry_point entry_point) {
-    BLOCK_TIMER_SIGNAL;
-    if (available_ids.empty() || !entry_point) {
-        THREAD_LIBRARY_ERROR("Unable to spawn thread");
-        UNBLOCK_TIMER_SIGNAL;
-        return FAILURE;
+/**
+ * Mark a thread that will never run again as terminated and wake its joiner.
+ * The joiner only reaps it once it runs itself, i.e. after the switch away from
+ * a terminating RUNNING thread, so its stack is no longer in use by then.
+ */
+static void exit_thread(Thread* t) {
+    t->set_state(ThreadState::TERMINATED);
+    if (t == coro_carrier) {
+        // Terminated by the user: the next coroutine post spawns a new one
+        coro_carrier = nullptr;
+        coro_carrier_parked = false;
     }
-    int id = -(available_ids.top());
-    available_ids.pop();
-    Thread* t = nullptr;
-    try {
-        t = new Thread(id, entry_point);
+    publish(t);
+    Thread* joiner = wait_queue_pop(&t->joiners);
+    if (joiner) {
+        wake_waiter(joiner);
     }
-    catch (const std::bad_alloc& e) {
-        SYSTEM_ERROR("Thread creation failed: bad_alloc");
-        UNBLOCK_TIMER_SIGNAL;
-        exit_status = 1;
-        uthread_terminate(0);
+}
+
+/**
+ * Run the destructors of the calling thread's thread-specific values as it
+ * terminates itself, again while they set new values, up to
+ * UTHREAD_DESTRUCTOR_ITERATIONS passes. Called without the scheduler lock.
+ */
+static void run_key_destructors(Thread* self) {
+    for (int pass = 0; pass < UTHREAD_DESTRUCTOR_ITERATIONS; pass++) {
+        bool called = false;
+        for (int key = 0; key < UTHREAD_KEYS_MAX; key++) {
+            void* value = self->specific[key];
+            void (*destructor)(void*) = key_destructors[key];
+            if (value && destructor && key_in_use[key]) {
+                self->specific[key] = nullptr;
+                destructor(value);
+                called = true;
+            }
+        }
+        if (!called) {
+            return;
+        }
     }
-    ready_queue.push(t);
-    all_threads[id] = t;
-    UNBLOCK_TIMER_SIGNAL;
-    return id;
 }
 
 /**
- * Remove a thread from the ready queue by its tid.
- * @param tid Thread ID to remove.
+ * Destructor call taken from a thread terminated by another thread, made by
+ * the terminating thread once it released the scheduler lock.
+ */
+struct KeyDestructorCall {
+    void (*destructor)(void*);
+    void* value;
+};
+
+/**
+ * Move t's thread-specific values that have a destructor into calls, resetting
+ * them. Must be called with the scheduler locked.
+ * @return The number of calls stored.
  */
-static void remove_thread_from_ready_queue(const int tid) {
-    std::queue<Thread*> temp;
-    while (!ready_queue.empty()) {
-        Thread* curr = ready_queue.front();
-        ready_queue.pop();
-        if (curr->tid != tid) temp.push(curr);
+static int take_key_destructors(Thread* t, KeyDestructorCall* calls) {
+    int n = 0;
+    for (int key = 0; key < UTHREAD_KEYS_MAX; key++) {
+        void* value = t->specific[key];
+        if (value && key_destructors[key] && key_in_use[key]) {
+            t->specific[key] = nullptr;
+            calls[n].destructor = key_destructors[key];
+            calls[n].value = value;
+            n++;
+        }
     }
-    ready_queue = temp;
+    return n;
 }
 
-int uthread_terminate(int tid) {
-    BLOCK_TIMER_SIGNAL;
-    if (all_threads.find(tid) == all_threads.end()) {
-        THREAD_LIBRARY_ERROR("Thread ID does not exist");
-        UNBLOCK_TIMER_SIGNAL;
-        return FAILURE;
+/**
+ * Finalize and clean up a thread marked for termination. A joinable thread is
+ * kept, with its result, until it is joined.
+ */
+void finalize_terminated_thread(Worker* w) {
+    Thread* t = w->should_terminate;
+    w->should_terminate = nullptr;
+    if (!t->joinable) {
+        reap_thread(t);
     }
+    if (w->current == w->idle) {
+        pause_timer(w);
+    } else {
+        reset_timer(w);
+    }
+}
 
-    if (tid == 0) {
-        if (current_thread->tid==0){
-            clean_and_exit(0);
+static void enqueue_current_if_needed(Worker* w, unsigned long long now) {
+    Thread* current = w->current;
+    if (w->should_terminate || current == w->idle) {
+        return;
+    }
+    if (current->terminate_requested) {
+        exit_thread(current);
+        w->should_terminate = current;
+        return;
+    }
+    if (current->get_state() == ThreadState::RUNNING && !current->is_sleeping() && !current->is_waiting()) {
+        make_ready(w, current, false, now);
+    }
+}
+
+/**
+ * Take a ready thread from another worker's run queue, the one it would run next.
+ */
+static Thread* steal_thread(Worker* thief) {
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker* victim = workers[(thief->index + i) % workers.size()];
+        Thread* t = victim->ready_queue->pick_next();
+        if (t) {
+            return t;
         }
-        end_process = true;
-        siglongjmp(all_threads[0]->env, 1);
     }
+    return nullptr;
+}
 
-    Thread* to_delete = all_threads[tid];
-    if (current_thread->tid == tid) {
-        should_terminate = current_thread;
-        UNBLOCK_TIMER_SIGNAL;
-        switch_thread();
-        return SUCCESS;
+static Thread* pick_next(Worker* w) {
+    Thread* next = w->ready_queue->pick_next();
+    if (!next && multi_worker) {
+        next = steal_thread(w);
     }
+    return next;
+}
 
-    all_threads.erase(tid);
-    sleeping_threads.erase(to_delete);
-    available_ids.push(-tid);
-    delete to_delete;
+static void handle_end_process(Worker* w) {
+    if (end_process && w->current->tid == 0) {
+        w->ready_queue->clear();
+        quantum_sleepers.clear();
+        usec_sleepers.clear();
+        clean_and_exit(0);
+    }
+}
 
-    remove_thread_from_ready_queue(tid);
-    UNBLOCK_TIMER_SIGNAL;
-    return SUCCESS;
+static void handle_should_terminate(Worker* w) {
+    if (w->should_terminate) {
+        finalize_terminated_thread(w);
+    }
 }
 
-int uthread_block(int tid) {
-    BLOCK_TIMER_SIGNAL;
-    if (tid == 0 || all_threads.find(tid) == all_threads.end()) {
-        THREAD_LIBRARY_ERROR("Invalid operation");
-        UNBLOCK_TIMER_SIGNAL;
-        return FAILURE;
+/**
+ * Bookkeeping that runs on the new thread's stack right after a switch.
+ */
+static void finish_switch() {
+    Worker* w = local_worker();
+    handle_end_process(w);
+    handle_should_terminate(w);
+}
+
+/**
+ * How long an idle single worker may block in epoll_wait: until the next
+ * quantum boundary if threads sleep for quanta, until the earliest deadline if
+ * threads sleep for micro-seconds, and for ever otherwise.
+ */
+static int idle_timeout_ms() {
+    long long usecs = -1;
+    if (!quantum_sleepers.empty()) {
+        usecs = quantum_duration;
     }
-    Thread* t = all_threads[tid];
-    if (t->get_state() != ThreadState::BLOCKED) {
-        t->set_state(ThreadState::BLOCKED);
-        std::queue<Thread*> temp;
-        while (!ready_queue.empty()) {
-            Thread* curr = ready_queue.front();
-            ready_queue.pop();
-            if (curr->tid != tid) temp.push(curr);
+    Thread* first = usec_sleepers.front();
+    if (first) {
+        unsigned long long now = monotonic_usecs();
+        long long until = first->wake_at > now ? (long long)(first->wake_at - now) : 0;
+        if (usecs < 0 || until < usecs) {
+            usecs = until;
         }
-        ready_queue = temp;
-        if (current_thread->tid == tid) {
-            UNBLOCK_TIMER_SIGNAL;
-            switch_thread();
-            return SUCCESS;
+    }
+    return usecs < 0 ? -1 : (int)((usecs + 999) / 1000);
+}
+
+/**
+ * Single worker only: nothing is READY and the running thread cannot go on
+ * (it is parked, sleeping, blocked or exiting). Wait on the spot, one quantum
+ * at a time, until a sleeper is due. With no sleepers nothing can ever become
+ * READY again, so the process exits.
+ */
+static Thread* wait_for_ready_thread(Worker* w) {
+    struct timespec pause = {quantum_duration / 1000000, (quantum_duration % 1000000) * 1000L};
+    if (quantum_duration == 0) {
+        pause.tv_nsec = IDLE_SLEEP_NSECS;
+    }
+    Thread* next;
+    while (!(next = pick_next(w))) {
+        if (reactor.has_waiters() || async_io.in_flight() || parked_receivers) {
+            flush_aio();
+            poll_io(idle_timeout_ms());
+            reap_aio();
+            answer_doorbell();
+        } else if (quantum_sleepers.empty() && usec_sleepers.empty()) {
+            THREAD_LIBRARY_ERROR("deadlock: no thread can run");
+            exit_status = 1;
+            clean_and_exit(exit_status);
+        } else {
+            nanosleep(&pause, nullptr);
         }
+        update_sleeping_threads(w);
     }
-    UNBLOCK_TIMER_SIGNAL;
-    return SUCCESS;
+    return next;
 }
 
-int uthread_resume(int tid) {
-    BLOCK_TIMER_SIGNAL;
-    if (all_threads.find(tid) == all_threads.end()) {
-        THREAD_LIBRARY_ERROR("Thread ID does not exist");
-        UNBLOCK_TIMER_SIGNAL;
-        return FAILURE;
+/**
+ * Charge the slice that ends to prev and the ready-queue wait that ends to
+ * next, and trace the switch.
+ */
+static void account_switch(Worker* w, Thread* prev, Thread* next, int reason, unsigned long long now) {
+    if (prev != w->idle) {
+        prev->stats.run_cycles += now - prev->run_start;
+        if (prev != next) {
+            prev->stats.switches[reason]++;
+        }
+        if (adaptive_quantum && prev->quantum_usecs == 0) {
+            adapt_slice(prev, reason);
+        }
     }
-    Thread* t = all_threads[tid];
-    if (t->get_state() == ThreadState::BLOCKED && sleeping_threads.find(t) == sleeping_threads.end()) {
-        t->set_state(ThreadState::READY);
-        ready_queue.push(t);
+    if (next != w->idle) {
+        unsigned long long waited = now - next->ready_since;
+        next->stats.ready_cycles += waited;
+        if (waited > next->stats.max_ready_cycles) {
+            next->stats.max_ready_cycles = waited;
+        }
+        if (next->woken) {
+            next->woken = false;
+            next->stats.wakeups++;
+            next->stats.wakeup_latency_cycles += waited;
+            if (waited > next->stats.max_wakeup_latency_cycles) {
+                next->stats.max_wakeup_latency_cycles = waited;
+            }
+        }
+        next->run_start = now;
+    }
+    if (prev != next) {
+        w->trace.record(now, TRACE_SWITCH, prev->tid, next->tid, reason);
     }
-    UNBLOCK_TIMER_SIGNAL;
-    return SUCCESS;
 }
 
-int uthread_sleep(int num_quantums) {
-    BLOCK_TIMER_SIGNAL;
-    if (current_thread->tid == 0 || num_quantums < 0) {
-        THREAD_LIBRARY_ERROR("Invalid sleep operation");
-        UNBLOCK_TIMER_SIGNAL;
-        return FAILURE;
+/**
+ * Make next the running thread of w and switch to it.
+ * Returns, with the scheduler still locked, once the previous thread runs again.
+ * @param keep_timer Leave the running timer interval alone if next's slice needs
+ *                   the same interval: the quantum expired and the periodic timer
+ *                   already started the next one, or the caller yielded.
+ * @param reason UTHREAD_SWITCH_* reason the previous thread leaves the CPU.
+ * @param now trace_clock() time of the switch.
+ */
+static void switch_to(Worker* w, Thread* next, bool keep_timer, int reason, unsigned long long now) {
+    Thread* prev = w->current;
+    account_switch(w, prev, next, reason, now);
+    if (!multi_worker) {
+        uthread_inline_tid = next->tid;
+        current_thread = next;
+    } else {
+        // Before current changes, for running_thread on other kernel threads
+        w->switches.store(w->switches.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    w->current = next;
+    if (next != w->idle) {
+        w->preempt_pending = 0;
+        next->set_state(ThreadState::RUNNING);
+        next->set_quantums(next->get_quantums() + 1);
+        uthread_inline_total_quantums = uthread_inline_total_quantums + 1;
+    }
+    prev->on_cpu = false;
+    next->on_cpu = true;
+    if (prev != w->idle) {
+        publish(prev);
+    }
+    if (next != w->idle && next != prev) {
+        publish(next);
     }
+    if (!w->should_terminate) {
+        if (next == w->idle) {
+            pause_timer(w);
+        } else if (!keep_timer || prev == w->idle || timer_usecs(next) != w->armed_usecs) {
+            reset_timer(w);
+        }
+        context_switch(&prev->context, &next->context);
+        finish_switch();
+    }
+    else {
+        context_jump(&next->context);
+    }
+}
 
-    current_thread->set_sleep_time(num_quantums+1);
-    sleeping_threads.insert(current_thread);
-    UNBLOCK_TIMER_SIGNAL;
-    switch_thread();
-    return SUCCESS;
+/**
+ * Switch context to the next ready thread.
+ * Handles sleeping, termination, and process end. Must be called with the
+ * scheduler locked; returns, still locked, once the caller is scheduled again.
+ * @param reason UTHREAD_SWITCH_* reason the caller leaves the CPU.
+ * @param keep_timer Do not restart the timer for the next thread.
+ */
+static void schedule(int reason, bool keep_timer = false) {
+    Worker* w = local_worker();
+    update_sleeping_threads(w);
+    if (reactor.has_waiters()) {
+        poll_io(0);
+    }
+    reap_aio();
+    // A thread parking on its operation must not wait for the next tick to submit it
+    if (timer_mode == UTHREAD_TIMER_NONE || w->current->aio) {
+        flush_aio();
+    }
+    answer_doorbell();
+    // One clock read times both the requeue and the switch
+    unsigned long long now = trace_clock();
+    if (w->current != w->idle) {
+        // Before it is queued again, so that the policy orders it by the slice that ends
+        w->ready_queue->charge(w->current, now - w->current->run_start);
+    }
+    enqueue_current_if_needed(w, now);
+    Thread* next = pick_next(w);
+    if (!next) {
+        // The running thread would have been queued if it could go on
+        if (w->idle) {
+            next = w->idle;
+        } else {
+            next = wait_for_ready_thread(w);
+            now = trace_clock();
+        }
+    }
+    switch_to(w, next, keep_timer, reason, now);
+}
+
+/**
+ * Preempt the running thread at the end of its quantum.
+ */
+void switch_thread() {
+    SCHEDULER_LOCK;
+    local_worker()->preempt_pending = 0;
+    flush_aio();
+    schedule(UTHREAD_SWITCH_PREEMPT, true);
+    SCHEDULER_UNLOCK;
 }
 
-int uthread_get_tid() {
-    return current_thread->tid;
+/**
+ * First code executed by every spawned thread. The scheduler is still locked
+ * by the switch that got us here. Returning from the entry point terminates the
+ * thread.
+ */
+void thread_start() {
+    finish_switch();
+    // Read before unlocking: a preemption after it may move the thread to another worker
+    Thread* self = local_worker()->current;
+    SCHEDULER_UNLOCK;
+    if (self->start_routine) {
+        self->result = self->start_routine(self->arg);
+    } else {
+        self->entry_point();
+    }
+    uthread_terminate(self->tid);
 }
 
-int uthread_get_total_quantums() {
-    return total_quantums;
+/**
+ * Scheduler loop of a worker that has nothing to run.
+ * Runs with the timer signal blocked, so that a process-wide tick goes to a
+ * worker that is running a thread, and with the scheduler locked except while
+ * backing off. Leaves to any thread it can take from a run queue.
+ */
+static void worker_idle_loop() {
+    finish_switch();
+    pthread_sigmask(SIG_BLOCK, &blocked_sets, nullptr);
+    int empty_polls = 0;
+    while (true) {
+        Worker* w = local_worker();
+        if (!usec_sleepers.empty()) {
+            wake_expired(w, usec_sleepers, monotonic_usecs());
+        }
+        if (reactor.has_waiters()) {
+            poll_io(0);
+        }
+        flush_aio();
+        reap_aio();
+        answer_doorbell();
+        Thread* next = pick_next(w);
+        if (next) {
+            empty_polls = 0;
+            pthread_sigmask(SIG_UNBLOCK, &blocked_sets, nullptr);
+            switch_to(w, next, false, UTHREAD_SWITCH_YIELD, trace_clock());
+            pthread_sigmask(SIG_BLOCK, &blocked_sets, nullptr);
+            continue;
+        }
+        scheduler_spinlock.unlock();
+        if (++empty_polls < IDLE_SPINS) {
+            sched_yield();
+        } else {
+            struct timespec pause = {0, IDLE_SLEEP_NSECS};
+            nanosleep(&pause, nullptr);
+        }
+        scheduler_spinlock.lock();
+    }
 }
 
-int uthread_get_quantums(int tid) {
-    BLOCK_TIMER_SIGNAL;
-    if (all_threads.find(tid) == all_threads.end()) {
-        THREAD_LIBRARY_ERROR("Thread ID does not exist");
-        UNBLOCK_TIMER_SIGNAL;
-        return FAILURE;
+static void* worker_main(void* arg) {
+    Worker* w = (Worker*)arg;
+    this_worker = w;
+    if (!w->timer.init(timer_mode, SIGVTALRM)) {
+        SYSTEM_ERROR("timer_create failed");
+        exit(1);
+    }
+    scheduler_spinlock.lock();
+    w->current = w->idle;
+    worker_idle_loop();
+    return nullptr;
+}
+
+void timer_handler(int sig) {
+    Worker* w = local_worker();
+    if (!w) {
+        // The process-wide timer signal hit a kernel thread the library does
+        // not run on (e.g. one that sends on a channel): pass the tick on
+        int saved_errno = errno;
+        pthread_kill(workers[0]->kernel_thread, sig);
+        errno = saved_errno;
+        return;
+    }
+    Thread* running = w->current;
+    if (!running || running->in_scheduler) {
+        w->preempt_pending = 1;
+        return;
     }
-    int quantums = all_threads[tid]->get_quantums();
-    UNBLOCK_TIMER_SIGNAL;
-    return quantums;
-}
\ No newline at end of file
+    int saved_errno = errno;
+    switch_thread();
+    errno = saved_errno;
+}
+
+void free_memory(){
+    for (size_t tid = 0; tid < all_threads.capacity(); tid++) {
+        delete all_threads.get((int)tid);
+    }
+    all_threads.clear();
+    for (Worker* w : workers) {
+        w->ready_queue->clear();
+    }
+    quantum_sleepers.clear();
+    usec_sleepers.clear();
+    thread_pool.clear();
+}
+
+static void init_signal_mask() {
+    if (sigemptyset(&blocked_sets) == -1) {
+        SYSTEM_ERROR("sigemptyset failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    if (sigaddset(&blocked_sets, SIGVTALRM) == -1) {
+        SYSTEM_ERROR("sigaddset failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+}
+
+static void init_thread_table(size_t max_threads) {
+    try {
+        all_threads.reset(max_threads);
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Thread table allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+}
+
+static void init_main_thread() {
+    Thread* main_thread = nullptr;
+    try {
+        main_thread = new Thread();
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Thread creation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    main_thread->run_start = trace_clock();
+    all_threads.set(0, main_thread);
+    workers[0]->current = main_thread;
+    uthread_inline_tid = 0;
+    current_thread = main_thread;
+    publish(main_thread);
+}
+
+/**
+ * Create the worker objects. Worker 0 is the calling kernel thread; with more
+ * than one worker every worker also gets an idle context to fall back to.
+ */
+static void init_workers(int num_workers, size_t trace_events) {
+    try {
+        for (int i = 0; i < num_workers; i++) {
+            Worker* w = new Worker(i);
+            workers.push_back(w);
+            w->ready_queue = make_sched_policy(sched_policy, aging_interval);
+            w->ready_queue->reserve(all_threads.id_limit());
+            w->trace.reset(trace_events);
+            if (num_workers > 1) {
+                w->idle = i == 0 ? new Thread(-1, nullptr, IDLE_STACK_SIZE) : new Thread();
+                w->idle->tid = -1;
+                w->idle->on_cpu = false;
+                w->idle->in_scheduler = 1;  // the idle loop always runs with the scheduler locked
+            }
+        }
+        quantum_sleepers.reserve(all_threads.id_limit());
+        usec_sleepers.reserve(all_threads.id_limit());
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Worker creation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    if (num_workers > 1) {
+        Thread* idle = workers[0]->idle;
+        context_init(&idle->context, idle->stack.base, idle->stack.size, worker_idle_loop);
+    }
+    this_worker = workers[0];
+    workers[0]->kernel_thread = pthread_self();
+    if (!workers[0]->timer.init(timer_mode, SIGVTALRM)) {
+        SYSTEM_ERROR("timer_create failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+}
+
+/**
+ * Start the kernel threads of workers 1..n-1. They inherit the blocked timer
+ * signal and wait on the scheduler lock until uthread_init_ex releases it.
+ */
+static void start_workers() {
+    if (workers.size() <= 1) {
+        return;
+    }
+    multi_worker = true;
+    // Which thread runs depends on the kernel thread from now on
+    uthread_inline_tid = -1;
+    current_thread = nullptr;
+    scheduler_spinlock.lock();
+    pthread_sigmask(SIG_BLOCK, &blocked_sets, nullptr);
+    for (size_t i = 1; i < workers.size(); i++) {
+        if (pthread_create(&workers[i]->kernel_thread, nullptr, worker_main, workers[i]) != 0) {
+            SYSTEM_ERROR("pthread_create failed");
+            exit_status = 1;
+            clean_and_exit(exit_status);
+        }
+    }
+    pthread_sigmask(SIG_UNBLOCK, &blocked_sets, nullptr);
+}
+
+static void setup_timer_handler() {
+    if (timer_mode == UTHREAD_TIMER_NONE) {
+        return;
+    }
+    struct sigaction sa = {0};
+    sa.sa_handler = &timer_handler;
+    // The handler may switch to another thread, which must not inherit a
+    // blocked timer signal; re-entry is handled through in_scheduler.
+    sa.sa_flags = SA_NODEFER;
+    if (sigaction(SIGVTALRM, &sa, nullptr) == -1) {
+        SYSTEM_ERROR("sigaction failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+}
+
+static void init_thread_pool(const uthread_init_attr_t* attr) {
+    thread_pool.set_max_idle(attr->pool_max);
+    try {
+        thread_pool.prewarm(attr->pool_prewarm);
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Thread pool allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+}
+
+int uthread_init(int quantum_usecs) {
+    uthread_init_attr_t attr;
+    uthread_init_attr_init(&attr, quantum_usecs);
+    return uthread_init_ex(&attr);
+}
+
+void uthread_init_attr_init(uthread_init_attr_t* attr, int quantum_usecs) {
+    attr->quantum_usecs = quantum_usecs;
+    attr->pool_max = POOL_MAX_IDLE;
+    attr->pool_prewarm = 0;
+    attr->max_threads = MAX_THREAD_NUM;
+    attr->num_workers = 1;
+    attr->timer_mode = UTHREAD_TIMER_PROCESS;
+    attr->aging_interval = 0;
+    attr->sched_policy = UTHREAD_SCHED_RR;
+    attr->adaptive_quantum = 0;
+    attr->aio_backend = UTHREAD_AIO_URING;
+    attr->trace_events = 0;
+    attr->task_workers = 0;
+}
+
+int uthread_init_ex(const uthread_init_attr_t* attr) {
+    end_process = false;
+    exit_status = 0;
+
+    if (!attr || attr->timer_mode < UTHREAD_TIMER_PROCESS || attr->timer_mode > UTHREAD_TIMER_NONE) {
+        THREAD_LIBRARY_ERROR("Invalid timer mode");
+        return FAILURE;
+    }
+    if (attr->timer_mode == UTHREAD_TIMER_NONE ? attr->quantum_usecs < 0 : attr->quantum_usecs <= 0) {
+        THREAD_LIBRARY_ERROR("Invalid quantum value");
+        return FAILURE;
+    }
+    if (attr->max_threads < 1 || attr->max_threads > MAX_THREAD_LIMIT) {
+        THREAD_LIBRARY_ERROR("Invalid thread limit");
+        return FAILURE;
+    }
+    if (attr->num_workers < 1 || attr->num_workers > MAX_WORKERS) {
+        THREAD_LIBRARY_ERROR("Invalid number of workers");
+        return FAILURE;
+    }
+    if (attr->aging_interval < 0) {
+        THREAD_LIBRARY_ERROR("Invalid aging interval");
+        return FAILURE;
+    }
+    if (attr->sched_policy < UTHREAD_SCHED_RR || attr->sched_policy > UTHREAD_SCHED_EDF) {
+        THREAD_LIBRARY_ERROR("Invalid scheduling policy");
+        return FAILURE;
+    }
+    if (attr->aio_backend < UTHREAD_AIO_URING || attr->aio_backend > UTHREAD_AIO_THREADS) {
+        THREAD_LIBRARY_ERROR("Invalid asynchronous I/O backend");
+        return FAILURE;
+    }
+    if (attr->task_workers < 0 || attr->task_workers > MAX_THREAD_LIMIT) {
+        THREAD_LIBRARY_ERROR("Invalid number of task workers");
+        return FAILURE;
+    }
+    init_signal_mask();
+    uthread_inline_total_quantums = 1;
+    quantum_duration = attr->quantum_usecs;
+    timer_mode = attr->timer_mode;
+    aging_interval = attr->aging_interval;
+    sched_policy = attr->sched_policy;
+    adaptive_quantum = attr->adaptive_quantum != 0;
+    aio_backend = attr->aio_backend;
+    max_task_helpers = attr->task_workers > 0 ? attr->task_workers : attr->num_workers;
+    init_thread_table(attr->max_threads);
+    init_thread_pool(attr);
+    trace_clock_init();
+    init_workers(attr->num_workers, attr->trace_events);
+    init_main_thread();
+    SCHEDULER_LOCK;
+    setup_timer_handler();
+    start_workers();
+    reset_timer(workers[0]);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_spawn(thread_entry_point entry_point) {
+    return uthread_spawn_ex(entry_point, nullptr);
+}
+
+void uthread_attr_init(uthread_attr_t* attr) {
+    attr->stack_size = STACK_SIZE;
+    attr->priority = UTHREAD_PRIORITY_DEFAULT;
+}
+
+static int spawn_locked(thread_entry_point entry_point, thread_start_routine start_routine, void* arg,
+                        size_t stack_size, int priority);
+
+static bool valid_priority(int priority) {
+    return priority >= UTHREAD_PRIORITY_MIN && priority <= UTHREAD_PRIORITY_MAX;
+}
+
+/**
+ * Create a READY thread running entry_point, or start_routine(arg) as a
+ * joinable thread when start_routine is set.
+ */
+static int spawn_thread(thread_entry_point entry_point, thread_start_routine start_routine, void* arg,
+                        const uthread_attr_t* attr) {
+    SCHEDULER_LOCK;
+    size_t stack_size = attr ? attr->stack_size : STACK_SIZE;
+    int priority = attr ? attr->priority : UTHREAD_PRIORITY_DEFAULT;
+    if ((!entry_point && !start_routine) || !stack_size_valid(stack_size) || !valid_priority(priority)) {
+        THREAD_LIBRARY_ERROR("Unable to spawn thread");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    int id = spawn_locked(entry_point, start_routine, arg, stack_size, priority);
+    if (id == FAILURE) {
+        THREAD_LIBRARY_ERROR("Unable to spawn thread");
+    }
+    SCHEDULER_UNLOCK;
+    return id;
+}
+
+/**
+ * Body of spawn_thread, with valid arguments and the scheduler locked.
+ * @return The new tid, or -1 if every id is in use.
+ */
+static int spawn_locked(thread_entry_point entry_point, thread_start_routine start_routine, void* arg,
+                        size_t stack_size, int priority) {
+    int id = all_threads.allocate_id();
+    if (id == FAILURE) {
+        return FAILURE;
+    }
+    Thread* t = nullptr;
+    try {
+        t = thread_pool.acquire(id, entry_point, stack_size);
+        // Any worker may end up queueing every thread, and every thread may sleep
+        for (Worker* w : workers) {
+            w->ready_queue->reserve(all_threads.id_limit());
+        }
+        quantum_sleepers.reserve(all_threads.id_limit());
+        usec_sleepers.reserve(all_threads.id_limit());
+    }
+    catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Thread creation failed: bad_alloc");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    t->priority = priority;
+    t->dynamic_priority = priority;
+    t->start_routine = start_routine;
+    t->arg = arg;
+    t->joinable = start_routine != nullptr;
+    make_ready(local_worker(), t, false);
+    all_threads.set(id, t);
+    return id;
+}
+
+int uthread_spawn_ex(thread_entry_point entry_point, const uthread_attr_t* attr) {
+    return spawn_thread(entry_point, nullptr, nullptr, attr);
+}
+
+int uthread_spawn_arg(thread_start_routine start_routine, void* arg) {
+    if (!start_routine) {
+        THREAD_LIBRARY_ERROR("Unable to spawn thread");
+        return FAILURE;
+    }
+    return spawn_thread(nullptr, start_routine, arg, nullptr);
+}
+
+int uthread_join(int tid, void** result) {
+    SCHEDULER_LOCK;
+    Thread* current = local_worker()->current;
+    Thread* t = all_threads.get(tid);
+    if (!t || t == current || !t->joinable || !wait_queue_empty(&t->joiners)) {
+        THREAD_LIBRARY_ERROR("Invalid join operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (t->get_state() != ThreadState::TERMINATED) {
+        // exit_thread wakes us once t has stopped running for good
+        park_current(&t->joiners);
+    }
+    if (result) {
+        *result = t->result;
+    }
+    reap_thread(t);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_detach(int tid) {
+    SCHEDULER_LOCK;
+    Thread* t = all_threads.get(tid);
+    if (!t || !t->joinable || !wait_queue_empty(&t->joiners)) {
+        THREAD_LIBRARY_ERROR("Invalid detach operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    t->joinable = false;
+    if (t->get_state() == ThreadState::TERMINATED) {
+        reap_thread(t);
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_set_priority(int tid, int priority) {
+    SCHEDULER_LOCK;
+    Thread* t = live_thread(tid);
+    if (!t || !valid_priority(priority)) {
+        THREAD_LIBRARY_ERROR("Invalid priority operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    t->priority = priority;
+    t->dynamic_priority = priority;
+    SchedPolicy* queue = t->run_queue;
+    if (queue) {
+        queue->dequeue(t);
+        queue->enqueue(t);
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_set_quantum(int tid, int usecs) {
+    SCHEDULER_LOCK;
+    Thread* t = live_thread(tid);
+    if (!t || usecs < 0) {
+        THREAD_LIBRARY_ERROR("Invalid quantum operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    t->quantum_usecs = usecs;
+    t->slice_usecs = 0;
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_set_deadline(int tid, int deadline_usecs) {
+    SCHEDULER_LOCK;
+    Thread* t = live_thread(tid);
+    if (!t) {
+        THREAD_LIBRARY_ERROR("Invalid deadline operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    t->deadline = deadline_usecs < 0 ? 0 : monotonic_usecs() + deadline_usecs;
+    SchedPolicy* queue = t->run_queue;
+    if (queue) {
+        queue->dequeue(t);
+        queue->enqueue(t);
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_terminate(int tid) {
+    // Destructors run unlocked, so self is read with running_thread, which a
+    // preemption that moves the caller to another worker cannot confuse
+    Thread* self = running_thread();
+    if (tid == self->tid && tid != 0) {
+        run_key_destructors(self);
+    }
+    SCHEDULER_LOCK;
+    Worker* w = local_worker();
+    Thread* to_delete = live_thread(tid);
+    if (!to_delete) {
+        THREAD_LIBRARY_ERROR("Thread ID does not exist");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+
+    if (tid == 0) {
+        // With several workers the main thread may be running elsewhere, so
+        // the process exits from the calling thread.
+        if (multi_worker || w->current->tid == 0) {
+            clean_and_exit(0);
+        }
+        end_process = true;
+        w->current = to_delete;
+        uthread_inline_tid = 0;
+        current_thread = to_delete;
+        to_delete->on_cpu = true;
+        context_jump(&to_delete->context);
+    }
+
+    if (w->current == to_delete) {
+        exit_thread(to_delete);
+        w->should_terminate = to_delete;
+        schedule(UTHREAD_SWITCH_TERMINATE);
+        return SUCCESS;
+    }
+
+    if (to_delete->on_cpu) {
+        // Running on another worker: finalized once that worker switches away.
+        to_delete->terminate_requested = true;
+        SCHEDULER_UNLOCK;
+        return SUCCESS;
+    }
+
+    remove_from_sleepers(to_delete);
+    remove_from_ready_queue(to_delete);
+    wait_queue_remove(to_delete);
+    reactor.remove(to_delete);
+    cancel_receive(to_delete);
+    KeyDestructorCall calls[UTHREAD_KEYS_MAX];
+    int pending = take_key_destructors(to_delete, calls);
+    exit_thread(to_delete);
+    if (!to_delete->joinable) {
+        reap_thread(to_delete);
+    }
+    SCHEDULER_UNLOCK;
+    for (int i = 0; i < pending; i++) {
+        calls[i].destructor(calls[i].value);
+    }
+    return SUCCESS;
+}
+
+int uthread_block(int tid) {
+    SCHEDULER_LOCK;
+    Thread* t = live_thread(tid);
+    if (tid == 0 || !t) {
+        THREAD_LIBRARY_ERROR("Invalid operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (t->get_state() != ThreadState::BLOCKED) {
+        t->set_state(ThreadState::BLOCKED);
+        remove_from_ready_queue(t);
+        publish(t);
+        if (local_worker()->current == t) {
+            schedule(UTHREAD_SWITCH_BLOCK);
+        }
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_resume(int tid) {
+    SCHEDULER_LOCK;
+    Thread* t = live_thread(tid);
+    if (!t) {
+        THREAD_LIBRARY_ERROR("Thread ID does not exist");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (t->get_state() == ThreadState::BLOCKED && !t->is_sleeping() && !t->is_waiting()) {
+        if (t->on_cpu) {
+            // Blocked from another worker that has not switched away from it yet
+            t->set_state(ThreadState::RUNNING);
+            publish(t);
+        } else {
+            make_ready(local_worker(), t, true);
+        }
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_yield() {
+    SCHEDULER_LOCK;
+    schedule(UTHREAD_SWITCH_YIELD, true);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_sleep(int num_quantums) {
+    SCHEDULER_LOCK;
+    Thread* current = local_worker()->current;
+    if (current->tid == 0 || num_quantums < 0) {
+        THREAD_LIBRARY_ERROR("Invalid sleep operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+
+    current->wake_at = sleep_ticks.load(std::memory_order_relaxed) + num_quantums + 1;
+    quantum_sleepers.push(current);
+    schedule(UTHREAD_SWITCH_SLEEP);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_sleep_usecs(int usecs) {
+    SCHEDULER_LOCK;
+    Thread* current = local_worker()->current;
+    if (current->tid == 0 || usecs < 0) {
+        THREAD_LIBRARY_ERROR("Invalid sleep operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+
+    current->wake_at = monotonic_usecs() + usecs;
+    usec_sleepers.push(current);
+    schedule(UTHREAD_SWITCH_SLEEP);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_get_tid_slow() {
+    // Not worker->current directly: the caller may move to another worker in between
+    return running_thread()->tid;
+}
+
+// Out-of-line copies of the inline getters, for callers that take their address
+// or were built against a header that declared them as plain functions
+__attribute__((used)) static int (*const out_of_line_getters[])() = {
+    uthread_get_tid,
+    uthread_get_total_quantums
+};
+
+int uthread_stats(int tid, uthread_stats_t* out) {
+    if (!out) {
+        THREAD_LIBRARY_ERROR("Invalid statistics buffer");
+        return FAILURE;
+    }
+    double cycles_per_usec = trace_cycles_per_usec();
+    SCHEDULER_LOCK;
+    Thread* t = all_threads.get(tid);
+    if (!t) {
+        THREAD_LIBRARY_ERROR("Thread ID does not exist");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    *out = t->stats;
+    // Include the slice or the wait in progress
+    unsigned long long now = trace_clock();
+    if (t->on_cpu) {
+        out->run_cycles += now - t->run_start;
+    } else if (t->run_queue) {
+        unsigned long long waited = now - t->ready_since;
+        out->ready_cycles += waited;
+        if (waited > out->max_ready_cycles) {
+            out->max_ready_cycles = waited;
+        }
+    }
+    out->quantums = t->get_quantums();
+    out->cycles_per_usec = cycles_per_usec;
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_trace_dump(int fd) {
+    if (fd < 0) {
+        THREAD_LIBRARY_ERROR("Invalid file descriptor");
+        return FAILURE;
+    }
+    double cycles_per_usec = trace_cycles_per_usec();
+    std::vector<std::vector<TraceEvent>> events;
+    SCHEDULER_LOCK;
+    if (!workers[0]->trace.enabled()) {
+        THREAD_LIBRARY_ERROR("Tracing is disabled");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    // Copy the rings so that the slow part runs unlocked
+    try {
+        events.resize(workers.size());
+        for (size_t i = 0; i < workers.size(); i++) {
+            const TraceBuffer& trace = workers[i]->trace;
+            events[i].reserve(trace.size());
+            for (size_t j = 0; j < trace.size(); j++) {
+                events[i].push_back(trace.at(j));
+            }
+        }
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Trace buffer allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    unsigned long long now = trace_clock();
+    SCHEDULER_UNLOCK;
+    if (!trace_write_json(fd, events.data(), events.size(), now, cycles_per_usec)) {
+        SYSTEM_ERROR("write failed");
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+// Observers read the summaries the scheduler publishes in all_threads, without
+// the scheduler lock, so they also work from kernel threads outside the library.
+
+int uthread_get_quantums(int tid) {
+    ThreadSummary summary;
+    if (!all_threads.read(tid, &summary)) {
+        THREAD_LIBRARY_ERROR("Thread ID does not exist");
+        return FAILURE;
+    }
+    return summary.quantums;
+}
+
+int uthread_get_state(int tid) {
+    ThreadSummary summary;
+    if (!all_threads.read(tid, &summary)) {
+        THREAD_LIBRARY_ERROR("Thread ID does not exist");
+        return FAILURE;
+    }
+    return summary.state;
+}
+
+int uthread_snapshot(uthread_snapshot_t* buf, int n) {
+    if (!buf || n < 0) {
+        THREAD_LIBRARY_ERROR("Invalid snapshot buffer");
+        return FAILURE;
+    }
+    unsigned long long ticks = sleep_ticks.load(std::memory_order_relaxed);
+    unsigned long long now = 0;
+    size_t limit = all_threads.id_limit();
+    int count = 0;
+    for (size_t tid = 0; tid < limit && count < n; tid++) {
+        ThreadSummary summary;
+        if (!all_threads.read((int)tid, &summary)) {
+            continue;
+        }
+        uthread_snapshot_t* out = &buf[count++];
+        out->tid = summary.tid;
+        out->state = summary.state;
+        out->quantums = summary.quantums;
+        out->sleep_quantums = 0;
+        out->sleep_usecs = 0;
+        if (summary.sleep_kind == SLEEP_QUANTUMS && summary.wake_at > ticks) {
+            // Woken by the tick that reaches wake_at
+            out->sleep_quantums = (int)(summary.wake_at - ticks);
+        } else if (summary.sleep_kind == SLEEP_USECS) {
+            if (now == 0) {
+                now = monotonic_usecs();
+            }
+            out->sleep_usecs = summary.wake_at > now ? (long long)(summary.wake_at - now) : 0;
+        }
+    }
+    return count;
+}
+
+// ================== Synchronization =====================
+
+/**
+ * Park the running thread on q and run other threads until it is handed the
+ * object it waits for. Must be called with the scheduler locked; returns still
+ * locked.
+ */
+static void park_current(uthread_wait_queue_t* q) {
+    wait_queue_push(q, local_worker()->current);
+    schedule(UTHREAD_SWITCH_WAIT);
+}
+
+/**
+ * Return a thread that was handed an object to the READY queue, unless it was
+ * blocked with uthread_block while waiting.
+ */
+static void wake_waiter(Thread* t) {
+    if (t->get_state() != ThreadState::BLOCKED) {
+        make_ready(local_worker(), t, true);
+    }
+}
+
+/**
+ * Unlock m, handing it straight to its oldest waiter if there is one.
+ */
+static void mutex_release(uthread_mutex_t* m) {
+    Thread* next = wait_queue_pop(&m->waiters);
+    m->owner = next ? next->tid : -1;
+    if (next) {
+        wake_waiter(next);
+    }
+}
+
+/**
+ * Move a thread signalled on a condition variable to its mutex: it becomes the
+ * holder if the mutex is free, and waits for it otherwise.
+ */
+static void cond_wake(Thread* t) {
+    uthread_mutex_t* m = t->wait_mutex;
+    t->wait_mutex = nullptr;
+    if (m->owner == -1) {
+        m->owner = t->tid;
+        wake_waiter(t);
+    } else {
+        wait_queue_push(&m->waiters, t);
+    }
+}
+
+int uthread_mutex_init(uthread_mutex_t* m) {
+    if (!m) {
+        THREAD_LIBRARY_ERROR("Invalid mutex");
+        return FAILURE;
+    }
+    m->owner = -1;
+    wait_queue_init(&m->waiters);
+    return SUCCESS;
+}
+
+int uthread_mutex_destroy(uthread_mutex_t* m) {
+    SCHEDULER_LOCK;
+    if (!m || m->owner != -1 || !wait_queue_empty(&m->waiters)) {
+        THREAD_LIBRARY_ERROR("Invalid mutex operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_mutex_lock(uthread_mutex_t* m) {
+    SCHEDULER_LOCK;
+    Thread* current = local_worker()->current;
+    if (!m || m->owner == current->tid) {
+        THREAD_LIBRARY_ERROR("Invalid mutex operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (m->owner == -1) {
+        m->owner = current->tid;
+    } else {
+        park_current(&m->waiters);
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_mutex_trylock(uthread_mutex_t* m) {
+    SCHEDULER_LOCK;
+    if (!m) {
+        THREAD_LIBRARY_ERROR("Invalid mutex operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    int busy = m->owner != -1;
+    if (!busy) {
+        m->owner = local_worker()->current->tid;
+    }
+    SCHEDULER_UNLOCK;
+    return busy;
+}
+
+int uthread_mutex_unlock(uthread_mutex_t* m) {
+    SCHEDULER_LOCK;
+    if (!m || m->owner != local_worker()->current->tid) {
+        THREAD_LIBRARY_ERROR("Invalid mutex operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    mutex_release(m);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_cond_init(uthread_cond_t* c) {
+    if (!c) {
+        THREAD_LIBRARY_ERROR("Invalid condition variable");
+        return FAILURE;
+    }
+    wait_queue_init(&c->waiters);
+    return SUCCESS;
+}
+
+int uthread_cond_destroy(uthread_cond_t* c) {
+    SCHEDULER_LOCK;
+    if (!c || !wait_queue_empty(&c->waiters)) {
+        THREAD_LIBRARY_ERROR("Invalid condition variable operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_cond_wait(uthread_cond_t* c, uthread_mutex_t* m) {
+    SCHEDULER_LOCK;
+    Thread* current = local_worker()->current;
+    if (!c || !m || m->owner != current->tid) {
+        THREAD_LIBRARY_ERROR("Invalid condition variable operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    current->wait_mutex = m;
+    mutex_release(m);
+    // Returns once cond_wake and then (possibly) mutex_release made us the holder
+    park_current(&c->waiters);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_cond_signal(uthread_cond_t* c) {
+    SCHEDULER_LOCK;
+    if (!c) {
+        THREAD_LIBRARY_ERROR("Invalid condition variable operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    Thread* t = wait_queue_pop(&c->waiters);
+    if (t) {
+        cond_wake(t);
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_cond_broadcast(uthread_cond_t* c) {
+    SCHEDULER_LOCK;
+    if (!c) {
+        THREAD_LIBRARY_ERROR("Invalid condition variable operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    Thread* t;
+    while ((t = wait_queue_pop(&c->waiters)) != nullptr) {
+        cond_wake(t);
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_sem_init(uthread_sem_t* s, int value) {
+    if (!s || value < 0) {
+        THREAD_LIBRARY_ERROR("Invalid semaphore");
+        return FAILURE;
+    }
+    s->value = value;
+    wait_queue_init(&s->waiters);
+    return SUCCESS;
+}
+
+int uthread_sem_destroy(uthread_sem_t* s) {
+    SCHEDULER_LOCK;
+    if (!s || !wait_queue_empty(&s->waiters)) {
+        THREAD_LIBRARY_ERROR("Invalid semaphore operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_sem_wait(uthread_sem_t* s) {
+    SCHEDULER_LOCK;
+    if (!s) {
+        THREAD_LIBRARY_ERROR("Invalid semaphore operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (s->value > 0) {
+        s->value--;
+    } else {
+        park_current(&s->waiters);
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_sem_trywait(uthread_sem_t* s) {
+    SCHEDULER_LOCK;
+    if (!s) {
+        THREAD_LIBRARY_ERROR("Invalid semaphore operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    int busy = s->value == 0;
+    if (!busy) {
+        s->value--;
+    }
+    SCHEDULER_UNLOCK;
+    return busy;
+}
+
+int uthread_sem_post(uthread_sem_t* s) {
+    SCHEDULER_LOCK;
+    if (!s) {
+        THREAD_LIBRARY_ERROR("Invalid semaphore operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    Thread* t = wait_queue_pop(&s->waiters);
+    if (t) {
+        wake_waiter(t);
+    } else {
+        s->value++;
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+// ================== I/O =====================
+
+int uthread_wait_fd(int fd, int events, int timeout_usecs) {
+    SCHEDULER_LOCK;
+    Thread* current = local_worker()->current;
+    if (fd < 0 || !(events & (UTHREAD_IO_READ | UTHREAD_IO_WRITE)) ||
+        (events & ~(UTHREAD_IO_READ | UTHREAD_IO_WRITE))) {
+        THREAD_LIBRARY_ERROR("Invalid I/O wait");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    int err = 0;
+    try {
+        err = reactor.add(fd, events, current);
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Reactor allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    if (err == EBUSY) {
+        THREAD_LIBRARY_ERROR("Another thread already waits on this fd");
+    }
+    if (err) {
+        SCHEDULER_UNLOCK;
+        // errno is per kernel thread, so it is only set once no switch can follow
+        errno = err;
+        return FAILURE;
+    }
+    if (timeout_usecs >= 0) {
+        current->wake_at = monotonic_usecs() + timeout_usecs;
+        usec_sleepers.push(current);
+    }
+    schedule(UTHREAD_SWITCH_WAIT);
+    int revents = current->io_revents;
+    SCHEDULER_UNLOCK;
+    return revents;
+}
+
+ssize_t uthread_read(int fd, void* buf, size_t count) {
+    while (true) {
+        ssize_t n = read(fd, buf, count);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return n;
+        }
+        if (errno != EINTR && uthread_wait_fd(fd, UTHREAD_IO_READ, -1) == FAILURE) {
+            return FAILURE;
+        }
+    }
+}
+
+ssize_t uthread_write(int fd, const void* buf, size_t count) {
+    while (true) {
+        ssize_t n = write(fd, buf, count);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return n;
+        }
+        if (errno != EINTR && uthread_wait_fd(fd, UTHREAD_IO_WRITE, -1) == FAILURE) {
+            return FAILURE;
+        }
+    }
+}
+
+int uthread_accept(int fd, struct sockaddr* addr, socklen_t* addrlen) {
+    while (true) {
+        int conn = accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (conn >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return conn;
+        }
+        if (errno != EINTR && uthread_wait_fd(fd, UTHREAD_IO_READ, -1) == FAILURE) {
+            return FAILURE;
+        }
+    }
+}
+
+/**
+ * Set up the asynchronous I/O backend on first use, and have the reactor watch
+ * its completion notifications so that an idle worker wakes up for them.
+ */
+static void init_async_io() {
+    if (!async_io.init(aio_backend)) {
+        SYSTEM_ERROR("asynchronous I/O setup failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    int err = 0;
+    try {
+        err = reactor.watch(async_io.notify_fd());
+    } catch (const std::bad_alloc& e) {
+        err = ENOMEM;
+    }
+    if (err) {
+        SYSTEM_ERROR("asynchronous I/O setup failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+}
+
+static ssize_t submit_aio(bool write, int fd, void* buf, size_t count, off_t offset) {
+    SCHEDULER_LOCK;
+    if (fd < 0) {
+        THREAD_LIBRARY_ERROR("Invalid file descriptor");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (!async_io.initialized()) {
+        init_async_io();
+    }
+    Thread* current = local_worker()->current;
+    AioRequest req = {current, write, fd, buf, count, offset, 0, nullptr};
+    while (!async_io.submit(&req)) {
+        // Too many operations in flight: let some of them complete first
+        flush_aio();
+        schedule(UTHREAD_SWITCH_YIELD, true);
+    }
+    current->aio = &req;
+    schedule(UTHREAD_SWITCH_WAIT);
+    ssize_t result = req.result;
+    SCHEDULER_UNLOCK;
+    if (result < 0) {
+        errno = (int)-result;
+        return FAILURE;
+    }
+    return result;
+}
+
+ssize_t uthread_pread(int fd, void* buf, size_t count, off_t offset) {
+    return submit_aio(false, fd, buf, count, offset);
+}
+
+ssize_t uthread_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    return submit_aio(true, fd, (void*)buf, count, offset);
+}
+
+// ================== Channels =====================
+
+/**
+ * Create the doorbell on first use and have the reactor watch it, so that an
+ * idle worker wakes up when a thread outside the library sends.
+ */
+static void init_doorbell() {
+    int err = doorbell.init() ? 0 : errno;
+    if (!err) {
+        try {
+            err = reactor.watch(doorbell.fd());
+        } catch (const std::bad_alloc& e) {
+            err = ENOMEM;
+        }
+    }
+    if (err) {
+        SYSTEM_ERROR("channel doorbell setup failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+}
+
+uthread_chan_t* uthread_chan_create(size_t capacity) {
+    SCHEDULER_LOCK;
+    if (capacity > CHAN_MAX_CAPACITY) {
+        THREAD_LIBRARY_ERROR("Invalid channel capacity");
+        SCHEDULER_UNLOCK;
+        return nullptr;
+    }
+    if (!doorbell.initialized()) {
+        init_doorbell();
+    }
+    uthread_chan_t* ch = nullptr;
+    try {
+        ch = new uthread_chan(capacity);
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Channel allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    SCHEDULER_UNLOCK;
+    return ch;
+}
+
+int uthread_chan_destroy(uthread_chan_t* ch) {
+    SCHEDULER_LOCK;
+    if (!ch || ch->receiver) {
+        THREAD_LIBRARY_ERROR("Invalid channel operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (ch->notified.load()) {
+        // Unlink it from the doorbell's list before it goes away
+        doorbell.drain(wake_receiver);
+    }
+    delete ch;
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_chan_send_batch(uthread_chan_t* ch, void* const* msgs, int count) {
+    if (!ch || count < 0 || (!msgs && count > 0)) {
+        THREAD_LIBRARY_ERROR("Invalid channel operation");
+        return FAILURE;
+    }
+    // Only library workers may take the scheduler lock. A uthread takes it for
+    // an unbounded channel, whose nodes are allocated with the global
+    // allocator, which must not be entered again by a preempting thread.
+    bool in_worker = local_worker() != nullptr;
+    bool locked = in_worker && ch->capacity == 0;
+    if (locked) {
+        SCHEDULER_LOCK;
+    }
+    int sent = 0;
+    while (sent < count && ch->push(msgs[sent])) {
+        sent++;
+    }
+    if (sent > 0 && ch->disarm()) {
+        if (!in_worker) {
+            doorbell.ring(ch);
+        } else {
+            if (!locked) {
+                SCHEDULER_LOCK;
+                locked = true;
+            }
+            wake_receiver(ch);
+        }
+    }
+    if (locked) {
+        SCHEDULER_UNLOCK;
+    }
+    return sent;
+}
+
+int uthread_chan_send(uthread_chan_t* ch, void* msg) {
+    int sent = uthread_chan_send_batch(ch, &msg, 1);
+    return sent < 0 ? FAILURE : sent == 1 ? 0 : 1;
+}
+
+/**
+ * Receive up to max messages, parking while the channel is empty.
+ */
+static int chan_receive(uthread_chan_t* ch, void** msgs, int max) {
+    SCHEDULER_LOCK;
+    Thread* current = local_worker()->current;
+    if (!ch || !msgs || max < 1 || (ch->receiver && ch->receiver != current)) {
+        THREAD_LIBRARY_ERROR("Invalid channel operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    int count = 0;
+    while (true) {
+        while (count < max && ch->pop(&msgs[count])) {
+            count++;
+        }
+        if (count > 0) {
+            break;
+        }
+        ch->receiver = current;
+        if (ch->arm()) {
+            continue;  // a message was published meanwhile
+        }
+        current->chan_wait = ch;
+        parked_receivers++;
+        schedule(UTHREAD_SWITCH_WAIT);
+    }
+    ch->receiver = nullptr;
+    SCHEDULER_UNLOCK;
+    return count;
+}
+
+int uthread_chan_recv(uthread_chan_t* ch, void** msg) {
+    return chan_receive(ch, msg, 1) < 0 ? FAILURE : SUCCESS;
+}
+
+int uthread_chan_recv_batch(uthread_chan_t* ch, void** msgs, int max) {
+    return chan_receive(ch, msgs, max);
+}
+
+int uthread_chan_try_recv(uthread_chan_t* ch, void** msg) {
+    SCHEDULER_LOCK;
+    Thread* current = local_worker()->current;
+    if (!ch || !msg || (ch->receiver && ch->receiver != current)) {
+        THREAD_LIBRARY_ERROR("Invalid channel operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    int empty = !ch->pop(msg);
+    SCHEDULER_UNLOCK;
+    return empty;
+}
+
+// ================== Task groups =====================
+
+/**
+ * Run a piece of work taken from the task queue, with the scheduler unlocked,
+ * and account for its completion. Must be called with the scheduler locked;
+ * returns still locked.
+ */
+static void run_task(Task* t, long begin, long end) {
+    uthread_taskgroup* g = t->group;
+    uthread_task_fn fn = t->fn;
+    uthread_range_fn range_fn = t->range_fn;
+    void* arg = range_fn ? t->ctx : t->arg;
+    if (!range_fn) {
+        task_queue.release(t);
+    }
+    SCHEDULER_UNLOCK;
+    if (range_fn) {
+        range_fn(begin, end, arg);
+    } else {
+        fn(arg);
+    }
+    SCHEDULER_LOCK;
+    if (--g->unfinished == 0) {
+        Thread* waiter;
+        while ((waiter = wait_queue_pop(&g->waiters)) != nullptr) {
+            wake_waiter(waiter);
+        }
+    }
+}
+
+/**
+ * Entry point of the task helper threads: run queued work for ever, parking
+ * while there is none.
+ */
+static void task_helper() {
+    SCHEDULER_LOCK;
+    while (true) {
+        long begin = 0;
+        long end = 0;
+        Task* t = task_queue.take(&begin, &end);
+        if (t) {
+            run_task(t, begin, end);
+        } else {
+            park_current(&idle_helpers);
+        }
+    }
+}
+
+/**
+ * Get up to pieces more helpers working on the task queue: wake idle ones,
+ * then start new ones while there are fewer than max_task_helpers. Waiting
+ * threads run their own group's work, so running short of helpers (or of
+ * thread ids) only costs parallelism.
+ */
+static void offer_work(unsigned long pieces) {
+    for (; pieces > 0; pieces--) {
+        Thread* helper = wait_queue_pop(&idle_helpers);
+        if (helper) {
+            wake_waiter(helper);
+        } else if (task_helpers < max_task_helpers &&
+                   spawn_locked(task_helper, nullptr, nullptr, STACK_SIZE, UTHREAD_PRIORITY_DEFAULT) != FAILURE) {
+            task_helpers++;
+        } else {
+            return;
+        }
+    }
+}
+
+/**
+ * Run g's unstarted work on the calling thread, then park until the pieces
+ * running elsewhere finish. Must be called with the scheduler locked.
+ */
+static void wait_group(uthread_taskgroup* g) {
+    while (g->unfinished > 0) {
+        long begin = 0;
+        long end = 0;
+        Task* t = task_queue.take_from(g, &begin, &end);
+        if (t) {
+            run_task(t, begin, end);
+        } else {
+            park_current(&g->waiters);
+        }
+    }
+}
+
+uthread_taskgroup_t* uthread_taskgroup_create(void) {
+    SCHEDULER_LOCK;
+    uthread_taskgroup_t* g = nullptr;
+    try {
+        g = new uthread_taskgroup();
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Task group allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    SCHEDULER_UNLOCK;
+    return g;
+}
+
+int uthread_taskgroup_destroy(uthread_taskgroup_t* g) {
+    SCHEDULER_LOCK;
+    if (!g || g->unfinished > 0 || !wait_queue_empty(&g->waiters)) {
+        THREAD_LIBRARY_ERROR("Invalid task group operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    delete g;
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_taskgroup_spawn(uthread_taskgroup_t* g, uthread_task_fn fn, void* arg) {
+    SCHEDULER_LOCK;
+    if (!g || !fn) {
+        THREAD_LIBRARY_ERROR("Invalid task group operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    Task* t = nullptr;
+    try {
+        t = task_queue.allocate();
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Task allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    t->group = g;
+    t->fn = fn;
+    t->arg = arg;
+    t->range_fn = nullptr;
+    t->ctx = nullptr;
+    g->unfinished++;
+    task_queue.push(t);
+    offer_work(1);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_taskgroup_wait(uthread_taskgroup_t* g) {
+    SCHEDULER_LOCK;
+    if (!g) {
+        THREAD_LIBRARY_ERROR("Invalid task group operation");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    wait_group(g);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_parallel_for(long begin, long end, long grain, uthread_range_fn fn, void* ctx) {
+    if (!fn || grain < 0) {
+        THREAD_LIBRARY_ERROR("Invalid parallel_for arguments");
+        return FAILURE;
+    }
+    if (end <= begin) {
+        return SUCCESS;
+    }
+    unsigned long count = (unsigned long)end - (unsigned long)begin;
+    if (grain == 0) {
+        // A few chunks per helper and for the caller, for load balance
+        grain = (long)(count / (PARALLEL_FOR_CHUNKS_PER_THREAD * ((unsigned long)max_task_helpers + 1)));
+        if (grain == 0) {
+            grain = 1;
+        }
+    }
+    unsigned long chunks = (count - 1) / (unsigned long)grain + 1;
+    if (chunks == 1) {
+        fn(begin, end, ctx);
+        return SUCCESS;
+    }
+    SCHEDULER_LOCK;
+    // Both live on this stack: wait_group only returns once no helper uses them
+    uthread_taskgroup g;
+    Task range = {};
+    range.group = &g;
+    range.range_fn = fn;
+    range.ctx = ctx;
+    range.next_index = begin;
+    range.end = end;
+    range.grain = grain;
+    g.unfinished = chunks;
+    task_queue.push(&range);
+    offer_work(chunks - 1);
+    wait_group(&g);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+// ================== Coroutines =====================
+
+/**
+ * Queue a coroutine whose sleep or fd wait is over for the carrier.
+ */
+static void wake_coroutine(uthread_coro_waiter_t* w) {
+    coro_sleepers.remove(w);
+    coro_poller.remove(w);
+    coro_ready.push(w);
+}
+
+/**
+ * Queue the coroutines that are due or whose fds are ready, without blocking.
+ */
+static void poll_coroutines() {
+    if (!coro_sleepers.empty()) {
+        unsigned long long now = monotonic_usecs();
+        uthread_coro_waiter_t* w;
+        while ((w = coro_sleepers.pop_expired(now)) != nullptr) {
+            // An fd wait that timed out
+            coro_poller.remove(w);
+            coro_ready.push(w);
+        }
+    }
+    if (coro_poller.has_waiters() && coro_poller.poll(wake_coroutine) < 0 && errno != EINTR) {
+        SYSTEM_ERROR("epoll_wait failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+}
+
+/**
+ * Park the carrier thread until a coroutine is posted, the earliest coroutine
+ * sleeper is due or an fd a coroutine waits on is ready. Called by the carrier
+ * with the scheduler locked; returns still locked.
+ */
+static void park_carrier() {
+    Thread* self = local_worker()->current;
+    if (coro_poller.has_waiters()) {
+        int err = 0;
+        try {
+            err = reactor.add(coro_poller.fd(), UTHREAD_IO_READ, self);
+        } catch (const std::bad_alloc& e) {
+            SYSTEM_ERROR("Reactor allocation failed");
+            exit_status = 1;
+            clean_and_exit(exit_status);
+        }
+        if (err) {
+            errno = err;
+            SYSTEM_ERROR("epoll_ctl failed");
+            exit_status = 1;
+            clean_and_exit(exit_status);
+        }
+    }
+    if (!coro_sleepers.empty()) {
+        self->wake_at = coro_sleepers.front()->wake_at;
+        usec_sleepers.push(self);
+    }
+    if (!self->is_sleeping() && !self->is_waiting()) {
+        wait_queue_push(&coro_carrier_idle, self);
+    }
+    coro_carrier_parked = true;
+    schedule(UTHREAD_SWITCH_WAIT);
+    coro_carrier_parked = false;
+}
+
+/**
+ * Entry point of the coroutine carrier thread: resume the ready coroutines in
+ * turn, then let the other threads run, for ever.
+ */
+static void coro_carrier_main() {
+    SCHEDULER_LOCK;
+    while (true) {
+        poll_coroutines();
+        uthread_coro_waiter_t* w = coro_ready.take_all();
+        if (!w) {
+            park_carrier();
+            continue;
+        }
+        SCHEDULER_UNLOCK;
+        while (w) {
+            // By the time fn returns, w may be queued again or its frame freed
+            uthread_coro_waiter_t* next = w->next;
+            w->fn(w->arg);
+            w = next;
+        }
+        SCHEDULER_LOCK;
+        if (!coro_ready.empty()) {
+            schedule(UTHREAD_SWITCH_YIELD);
+        }
+    }
+}
+
+/**
+ * Make sure the carrier thread exists and will look at the coroutine queues
+ * again. Must be called with the scheduler locked.
+ * @return false if the carrier could not be spawned.
+ */
+static bool notify_carrier() {
+    if (!coro_carrier) {
+        int tid = spawn_locked(coro_carrier_main, nullptr, nullptr, CORO_CARRIER_STACK_SIZE,
+                               UTHREAD_PRIORITY_DEFAULT);
+        if (tid == FAILURE) {
+            return false;
+        }
+        coro_carrier = all_threads.get(tid);
+        return true;
+    }
+    // Still parked, i.e. not already woken by its own timeout or fd
+    if (coro_carrier_parked && (coro_carrier->is_sleeping() || coro_carrier->is_waiting())) {
+        coro_carrier_parked = false;
+        wait_queue_remove(coro_carrier);
+        reactor.remove(coro_carrier);
+        wake_io_waiter(coro_carrier);
+    }
+    return true;
+}
+
+/**
+ * Reset the library-managed fields of a waiter that is about to be queued.
+ */
+static void init_coro_waiter(uthread_coro_waiter_t* w) {
+    w->next = nullptr;
+    w->sleep_index = -1;
+    w->fd = -1;
+    w->revents = 0;
+}
+
+void* uthread_coro_frame_alloc(size_t size) {
+    SCHEDULER_LOCK;
+    void* frame = nullptr;
+    try {
+        frame = frame_arena.allocate(size);
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Coroutine frame allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    SCHEDULER_UNLOCK;
+    return frame;
+}
+
+void uthread_coro_frame_free(void* frame, size_t size) {
+    if (!frame) {
+        return;
+    }
+    SCHEDULER_LOCK;
+    frame_arena.release(frame, size);
+    SCHEDULER_UNLOCK;
+}
+
+int uthread_coro_post(uthread_coro_waiter_t* w) {
+    SCHEDULER_LOCK;
+    if (!w || !w->fn) {
+        THREAD_LIBRARY_ERROR("Invalid coroutine waiter");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (!notify_carrier()) {
+        THREAD_LIBRARY_ERROR("Unable to spawn the coroutine carrier thread");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    init_coro_waiter(w);
+    coro_ready.push(w);
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_coro_sleep_usecs(uthread_coro_waiter_t* w, int usecs) {
+    SCHEDULER_LOCK;
+    if (!w || !w->fn || usecs < 0) {
+        THREAD_LIBRARY_ERROR("Invalid coroutine sleep");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (!notify_carrier()) {
+        THREAD_LIBRARY_ERROR("Unable to spawn the coroutine carrier thread");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    init_coro_waiter(w);
+    w->wake_at = monotonic_usecs() + usecs;
+    try {
+        coro_sleepers.push(w);
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Coroutine sleep queue allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_coro_wait_fd(uthread_coro_waiter_t* w, int fd, int events, int timeout_usecs) {
+    SCHEDULER_LOCK;
+    if (!w || !w->fn || fd < 0 || !(events & (UTHREAD_IO_READ | UTHREAD_IO_WRITE)) ||
+        (events & ~(UTHREAD_IO_READ | UTHREAD_IO_WRITE))) {
+        THREAD_LIBRARY_ERROR("Invalid I/O wait");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    if (!notify_carrier()) {
+        THREAD_LIBRARY_ERROR("Unable to spawn the coroutine carrier thread");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    init_coro_waiter(w);
+    int err = 0;
+    try {
+        err = coro_poller.add(fd, events, w);
+        if (!err && timeout_usecs >= 0) {
+            w->wake_at = monotonic_usecs() + timeout_usecs;
+            coro_sleepers.push(w);
+        }
+    } catch (const std::bad_alloc& e) {
+        SYSTEM_ERROR("Coroutine poller allocation failed");
+        exit_status = 1;
+        clean_and_exit(exit_status);
+    }
+    if (err == EBUSY) {
+        THREAD_LIBRARY_ERROR("Another coroutine already waits on this fd");
+    }
+    SCHEDULER_UNLOCK;
+    if (err) {
+        // errno is per kernel thread, so it is only set once no switch can follow
+        errno = err;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+// ================== Thread-specific data =====================
+
+int uthread_key_create(uthread_key_t* key, void (*destructor)(void*)) {
+    SCHEDULER_LOCK;
+    int k = 0;
+    while (k < UTHREAD_KEYS_MAX && key_in_use[k]) {
+        k++;
+    }
+    if (!key || k == UTHREAD_KEYS_MAX) {
+        THREAD_LIBRARY_ERROR("Unable to create key");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    key_destructors[k] = destructor;
+    key_in_use[k] = true;
+    *key = k;
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+int uthread_key_delete(uthread_key_t key) {
+    SCHEDULER_LOCK;
+    if (key < 0 || key >= UTHREAD_KEYS_MAX || !key_in_use[key]) {
+        THREAD_LIBRARY_ERROR("Invalid key");
+        SCHEDULER_UNLOCK;
+        return FAILURE;
+    }
+    key_in_use[key] = false;
+    key_destructors[key] = nullptr;
+    // So that the values do not show through a key created later in the same slot
+    for (size_t tid = 0; tid < all_threads.id_limit(); tid++) {
+        Thread* t = all_threads.get((int)tid);
+        if (t) {
+            t->specific[key] = nullptr;
+        }
+    }
+    SCHEDULER_UNLOCK;
+    return SUCCESS;
+}
+
+/*
+ * The values are read and written without the scheduler lock: other threads
+ * only clear them in uthread_key_delete, and running_thread finds the caller
+ * even when it is moved to another worker halfway through.
+ */
+void* uthread_getspecific(uthread_key_t key) {
+    if (key < 0 || key >= UTHREAD_KEYS_MAX) {
+        return nullptr;
+    }
+    return running_thread()->specific[key];
+}
+
+int uthread_setspecific(uthread_key_t key, const void* value) {
+    if (key < 0 || key >= UTHREAD_KEYS_MAX || !key_in_use[key]) {
+        THREAD_LIBRARY_ERROR("Invalid key");
+        return FAILURE;
+    }
+    running_thread()->specific[key] = const_cast<void*>(value);
+    return SUCCESS;
+}
@@ -6,11 +6,191 @@
 #ifndef _UTHREADS_H
 #define _UTHREADS_H
 
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
-#define MAX_THREAD_NUM 100 /* maximal number of threads */
-#define STACK_SIZE 4096 /* stack size per thread (in bytes) */
+#define MAX_THREAD_NUM 100 /* default maximal number of threads */
+#define MAX_THREAD_LIMIT 1048576 /* upper bound for uthread_init_attr_t.max_threads */
+#define MAX_WORKERS 256 /* upper bound for uthread_init_attr_t.num_workers */
+
+/* Thread priorities: a READY thread with a higher priority always runs first (under UTHREAD_SCHED_RR) */
+#define UTHREAD_PRIORITY_LEVELS 32
+#define UTHREAD_PRIORITY_MIN 0
+#define UTHREAD_PRIORITY_MAX (UTHREAD_PRIORITY_LEVELS - 1)
+#define UTHREAD_PRIORITY_DEFAULT 16
+
+/* Preemption timer modes for uthread_init_attr_t.timer_mode */
+#define UTHREAD_TIMER_PROCESS 0 /* process-wide ITIMER_VIRTUAL, the default */
+#define UTHREAD_TIMER_THREAD_CPU 1 /* per-worker timer on the worker's CPU time */
+#define UTHREAD_TIMER_WALL 2 /* per-worker timer on wall-clock (CLOCK_MONOTONIC) time */
+#define UTHREAD_TIMER_NONE 3 /* no preemption: threads switch only when they yield, block, sleep or exit */
+
+/* Scheduling policies for uthread_init_attr_t.sched_policy */
+#define UTHREAD_SCHED_RR 0 /* strict priorities, round-robin within a priority, the default */
+#define UTHREAD_SCHED_FAIR 1 /* CPU time shared in proportion to weights given by the priorities */
+#define UTHREAD_SCHED_EDF 2 /* earliest deadline first, see uthread_set_deadline */
+/* Events for uthread_wait_fd */
+#define UTHREAD_IO_READ 0x1
+#define UTHREAD_IO_WRITE 0x2
+
+/* Asynchronous file I/O backends for uthread_init_attr_t.aio_backend */
+#define UTHREAD_AIO_URING 0 /* io_uring, the default */
+#define UTHREAD_AIO_SQPOLL 1 /* io_uring with a kernel thread polling for submissions */
+#define UTHREAD_AIO_THREADS 2 /* blocking pread/pwrite on helper kernel threads */
+
+/* Thread states reported by uthread_get_state and uthread_snapshot */
+#define UTHREAD_STATE_RUNNING 0
+#define UTHREAD_STATE_READY 1
+#define UTHREAD_STATE_BLOCKED 2 /* uthread_block, until uthread_resume */
+#define UTHREAD_STATE_SLEEPING 3 /* uthread_sleep / uthread_sleep_usecs */
+#define UTHREAD_STATE_WAITING 4 /* parked on a mutex, condition, semaphore, join, fd, file I/O or channel */
+#define UTHREAD_STATE_TERMINATED 5 /* exited, kept until joined */
+
+/* Reasons a thread leaves the CPU, indexes of uthread_stats_t.switches */
+#define UTHREAD_SWITCH_PREEMPT 0 /* quantum expired */
+#define UTHREAD_SWITCH_YIELD 1 /* uthread_yield */
+#define UTHREAD_SWITCH_BLOCK 2 /* uthread_block */
+#define UTHREAD_SWITCH_SLEEP 3 /* uthread_sleep / uthread_sleep_usecs */
+#define UTHREAD_SWITCH_WAIT 4 /* parked on a mutex, condition, semaphore, join, fd, file I/O or channel */
+#define UTHREAD_SWITCH_TERMINATE 5 /* the thread exited */
+#define UTHREAD_SWITCH_REASONS 6
+
+#define STACK_SIZE 65536 /* default stack size per thread (in bytes) */
+#define UTHREAD_KEYS_MAX 32 /* thread-specific data keys, see uthread_key_create */
+#define UTHREAD_DESTRUCTOR_ITERATIONS 4 /* destructor passes at thread exit, see uthread_key_create */
+#define POOL_MAX_IDLE 64 /* default number of terminated threads kept for reuse */
 
 typedef void (*thread_entry_point)(void);
+typedef void* (*thread_start_routine)(void*);
+typedef void (*uthread_task_fn)(void* arg);
+typedef void (*uthread_range_fn)(long begin, long end, void* ctx);
+
+/**
+ * @brief Per-thread attributes for uthread_spawn_ex.
+ *
+ * Always initialize with uthread_attr_init before setting individual fields.
+ */
+typedef struct {
+    size_t stack_size; /* usable stack size in bytes, rounded up to whole pages */
+    int priority;      /* UTHREAD_PRIORITY_MIN .. UTHREAD_PRIORITY_MAX */
+} uthread_attr_t;
+
+/**
+ * @brief Library-wide settings for uthread_init_ex.
+ *
+ * Always initialize with uthread_init_attr_init before setting individual fields.
+ */
+typedef struct {
+    int quantum_usecs;   /* length of a quantum in micro-seconds */
+    size_t pool_max;     /* number of terminated threads (with their stacks) kept for reuse */
+    size_t pool_prewarm; /* number of threads allocated up front, at most pool_max */
+    int max_threads;     /* maximal number of concurrent threads, including the main thread */
+    int num_workers;     /* kernel threads running uthreads; more than one enables M:N scheduling */
+    int timer_mode;      /* one of the UTHREAD_TIMER_* preemption modes */
+    int aging_interval;  /* scheduling decisions between priority aging passes, 0 disables aging */
+    int aio_backend;     /* one of the UTHREAD_AIO_* backends for uthread_pread / uthread_pwrite */
+    size_t trace_events; /* scheduler events kept per worker for uthread_trace_dump, 0 disables tracing */
+    int task_workers;    /* helper threads running task group tasks and parallel_for chunks, 0 for one per worker */
+    int sched_policy;    /* one of the UTHREAD_SCHED_* policies ordering the READY threads */
+    int adaptive_quantum; /* nonzero: each thread's slice adapts to how much of it the thread uses */
+} uthread_init_attr_t;
+
+/**
+ * @brief Scheduling statistics of a thread, see uthread_stats.
+ *
+ * Times are in cycles of the library clock (the TSC on x86); divide by cycles_per_usec for micro-seconds.
+ */
+typedef struct {
+    unsigned long long run_cycles;                /* time spent RUNNING */
+    unsigned long long ready_cycles;              /* time spent READY, waiting for a worker */
+    unsigned long long max_ready_cycles;          /* longest single wait in the ready queue */
+    unsigned long long wakeups;                   /* times woken after blocking, sleeping or waiting */
+    unsigned long long wakeup_latency_cycles;     /* total time from being woken to running */
+    unsigned long long max_wakeup_latency_cycles; /* longest time from being woken to running */
+    unsigned long long switches[UTHREAD_SWITCH_REASONS]; /* times the thread left the CPU, by reason */
+    int quantums;                                 /* as uthread_get_quantums */
+    double cycles_per_usec;                       /* clock rate of the cycle counts above */
+} uthread_stats_t;
+
+/**
+ * @brief One thread in the output of uthread_snapshot.
+ */
+typedef struct {
+    int tid;
+    int state;              /* one of the UTHREAD_STATE_* values */
+    int quantums;           /* as uthread_get_quantums */
+    int sleep_quantums;     /* quantums left to sleep in uthread_sleep, 0 otherwise */
+    long long sleep_usecs;  /* micro-seconds left in uthread_sleep_usecs or before a uthread_wait_fd timeout, 0 otherwise */
+} uthread_snapshot_t;
+
+/**
+ * @brief FIFO of threads parked on a synchronization object, linked through the threads themselves.
+ *
+ * Managed by the library; only ever initialize it through the owning object's init function or initializer.
+ */
+typedef struct {
+    void* head;
+    void* tail;
+} uthread_wait_queue_t;
+
+/**
+ * @brief Non-recursive mutex. Unlocking hands the mutex directly to the oldest waiter.
+ */
+typedef struct {
+    int owner;                    /* tid of the holder, -1 when unlocked */
+    uthread_wait_queue_t waiters;
+} uthread_mutex_t;
+
+/**
+ * @brief Condition variable, used together with a uthread_mutex_t.
+ */
+typedef struct {
+    uthread_wait_queue_t waiters;
+} uthread_cond_t;
+
+/**
+ * @brief Counting semaphore. Posting hands the unit directly to the oldest waiter.
+ */
+typedef struct {
+    int value;
+    uthread_wait_queue_t waiters;
+} uthread_sem_t;
+
+/**
+ * @brief Multi-producer single-consumer message channel, see uthread_chan_create.
+ */
+typedef struct uthread_chan uthread_chan_t;
+
+/**
+ * @brief Set of tasks run by the library's task helper threads, see uthread_taskgroup_create.
+ */
+typedef struct uthread_taskgroup uthread_taskgroup_t;
+
+/**
+ * @brief Key of a thread-specific data slot, 0 .. UTHREAD_KEYS_MAX - 1, see uthread_key_create.
+ */
+typedef int uthread_key_t;
+
+/**
+ * @brief A suspended coroutine that the library resumes by calling fn(arg) on its coroutine carrier thread, see
+ * uthread_coro_post. It lives in the coroutine frame, so waiting never allocates.
+ *
+ * The caller sets fn and arg; the other fields are managed by the library.
+ */
+typedef struct uthread_coro_waiter {
+    void (*fn)(void* arg);
+    void* arg;
+    struct uthread_coro_waiter* next;  /* link in the carrier's ready FIFO */
+    unsigned long long wake_at;        /* absolute wake-up time in micro-seconds while sleeping */
+    int sleep_index;                   /* position in the sleep heap, -1 when not sleeping */
+    int fd;                            /* fd waited on, -1 when none */
+    int events;                        /* UTHREAD_IO_* events waited for on fd */
+    int revents;                       /* ready events after uthread_coro_wait_fd, 0 on timeout */
+} uthread_coro_waiter_t;
+
+#define UTHREAD_MUTEX_INITIALIZER { -1, { 0, 0 } }
+#define UTHREAD_COND_INITIALIZER { { 0, 0 } }
 
 /* External interface */
 
@@ -29,14 +209,72 @@ typedef void (*thread_entry_point)(void);
 */
 int uthread_init(int quantum_usecs);
 
+
+/**
+ * @brief Fills attr with the default library settings for the given quantum length.
+*/
+void uthread_init_attr_init(uthread_init_attr_t* attr, int quantum_usecs);
+
+
+/**
+ * @brief Initializes the thread library like uthread_init, using the settings in attr.
+ *
+ * Terminated threads whose stack has the default size are kept in a pool of at most pool_max entries and reused
+ * by later spawns, so spawn and terminate do not allocate once the pool is warm. pool_prewarm threads are
+ * allocated here so that even the first spawns are allocation free. max_threads (1 .. MAX_THREAD_LIMIT) replaces
+ * MAX_THREAD_NUM as the limit on concurrent threads; thread lookups are O(1) regardless of the limit.
+ *
+ * With num_workers > 1 (up to MAX_WORKERS) the library runs uthreads on that many kernel threads: the calling
+ * thread plus num_workers - 1 pthreads. Each worker has its own READY queue and takes threads from the other
+ * workers' queues when its own is empty, so uthreads may resume on a different kernel thread after any switch
+ * (native thread_local data and errno therefore do not follow a uthread). The API keeps its semantics, with two
+ * relaxations: blocking or terminating a thread that is RUNNING on another worker takes effect when that worker
+ * next switches away from it, and terminating the main thread exits the process from the calling thread.
+ * Link with -pthread.
+ *
+ * timer_mode selects how quanta are measured. UTHREAD_TIMER_PROCESS uses the process-wide virtual timer.
+ * UTHREAD_TIMER_THREAD_CPU and UTHREAD_TIMER_WALL give each worker its own POSIX timer, delivered only to that
+ * worker's kernel thread, on its CPU time or on wall-clock time respectively; wall-clock quanta also preempt
+ * threads that spend their time waiting in the kernel. In every mode the timer is only re-armed when a thread
+ * gives up the CPU before its quantum expires. UTHREAD_TIMER_NONE makes scheduling purely cooperative: no timer
+ * or signal handler is installed and quantum_usecs may be 0.
+ *
+ * With aging_interval > 0, every aging_interval scheduling decisions the oldest READY thread of each priority level
+ * (except the highest) is raised by one level, so that low priority threads are not starved forever. A thread
+ * returns to its own priority once it runs.
+ *
+ * sched_policy selects the order READY threads run in. UTHREAD_SCHED_RR is the strict priority order described at
+ * uthread_set_priority. UTHREAD_SCHED_FAIR runs the thread that has had the least CPU time relative to its weight,
+ * so that busy threads share the CPU in proportion to their weights: each priority level above
+ * UTHREAD_PRIORITY_DEFAULT gives 25% more weight and each level below 20% less, so threads ten levels apart get
+ * about 9:1. A thread that was blocked, sleeping or waiting does not make up for the time it missed. UTHREAD_SCHED_EDF
+ * runs the READY thread with the earliest deadline (uthread_set_deadline), even a missed one, and the threads without
+ * a deadline round-robin when none with a deadline is READY; priorities are ignored. aging_interval only applies to
+ * UTHREAD_SCHED_RR. Every policy is still preempted at the end of each quantum.
+ *
+ * With adaptive_quantum set, each thread without a quantum of its own (uthread_set_quantum) gets a slice of its own,
+ * between a quarter of quantum_usecs and four times quantum_usecs: a thread preempted at the end of its slice gets
+ * a slice twice as long, so that CPU-bound threads switch less often, and a thread that blocks, sleeps or waits
+ * before the end of its slice gets one half as long. Under UTHREAD_SCHED_RR only, a woken thread whose slice is
+ * shorter than quantum_usecs also runs ahead of the READY threads of its own priority (one level up until it runs);
+ * UTHREAD_SCHED_FAIR and UTHREAD_SCHED_EDF adapt the slices but keep their own order. Slices of
+ * different lengths need a timer per worker (UTHREAD_TIMER_THREAD_CPU or UTHREAD_TIMER_WALL) or a single worker:
+ * UTHREAD_TIMER_PROCESS workers share one timer, re-armed by whichever worker switches last.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init_ex(const uthread_init_attr_t* attr);
+
 /**
  * @brief Creates a new thread, whose entry point is the function entry_point with the signature
  * void entry_point(void).
  *
  * The thread is added to the end of the READY threads list.
  * The uthread_spawn function should fail if it would cause the number of concurrent threads to exceed the
- * limit (MAX_THREAD_NUM).
- * Each thread should be allocated with a stack of size STACK_SIZE bytes.
+ * limit (MAX_THREAD_NUM, or max_threads when initialized with uthread_init_ex). The new thread gets the smallest
+ * free ID.
+ * Each thread is allocated with a stack of size STACK_SIZE bytes.
+ * Returning from entry_point terminates the thread, exactly like calling uthread_terminate on itself.
  * It is an error to call this function with a null entry_point.
  *
  * @return On success, return the ID of the created thread. On failure, return -1.
@@ -44,6 +282,101 @@ int uthread_init(int quantum_usecs);
 int uthread_spawn(thread_entry_point entry_point);
 
 
+/**
+ * @brief Fills attr with the default attributes (a stack of STACK_SIZE bytes, UTHREAD_PRIORITY_DEFAULT).
+*/
+void uthread_attr_init(uthread_attr_t* attr);
+
+
+/**
+ * @brief Creates a new thread like uthread_spawn, using the attributes in attr.
+ *
+ * Stacks are mapped with mmap and lazily committed, with an inaccessible guard page below them so that a
+ * stack overflow faults instead of silently corrupting memory. A null attr is equivalent to the defaults.
+ * It is an error to call this function with a null entry_point, a zero stack_size, a stack_size too large to map
+ * (within a few pages of SIZE_MAX) or an invalid priority.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_ex(thread_entry_point entry_point, const uthread_attr_t* attr);
+
+
+/**
+ * @brief Creates a joinable thread that runs start_routine(arg), with the default attributes.
+ *
+ * The thread terminates when start_routine returns, or when it is terminated with uthread_terminate (its result is
+ * then NULL). A joinable thread keeps its ID after it terminates, until it is collected with uthread_join or
+ * released with uthread_detach, so that its result can still be retrieved; it counts against the thread limit
+ * until then. It is an error to call this function with a null start_routine.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_arg(thread_start_routine start_routine, void* arg);
+
+
+/**
+ * @brief Waits for the joinable thread with ID tid to terminate and releases its ID.
+ *
+ * If the thread has not terminated yet, the calling thread is parked (it does not run, and uses no CPU time) until
+ * it does. If result is not NULL, the return value of the thread's start_routine is stored in *result. It is an
+ * error if no thread with ID tid exists, if it is not joinable (threads created with uthread_spawn or
+ * uthread_spawn_ex, or detached threads), if it is the calling thread, or if another thread is already joining it.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_join(int tid, void** result);
+
+
+/**
+ * @brief Makes the joinable thread with ID tid release its ID as soon as it terminates, discarding its result.
+ *
+ * If the thread has already terminated, its ID is released immediately. It is an error if no thread with ID tid
+ * exists, if it is not joinable, or if another thread is already joining it.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_detach(int tid);
+
+
+/**
+ * @brief Sets the priority of the thread with ID tid.
+ *
+ * Under UTHREAD_SCHED_RR, the default policy, the scheduler always picks the oldest READY thread of the highest
+ * priority; threads of equal priority are scheduled round-robin. Under UTHREAD_SCHED_FAIR the priority sets the
+ * thread's CPU share instead (see uthread_init_ex). A READY thread moves to the end of its new priority level. The new priority of a RUNNING
+ * thread takes effect when it is next queued. If no thread with ID tid exists, or priority is outside
+ * UTHREAD_PRIORITY_MIN .. UTHREAD_PRIORITY_MAX, it is considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_priority(int tid, int priority);
+
+
+/**
+ * @brief Gives the thread with ID tid a deadline deadline_usecs micro-seconds from now, replacing its previous one.
+ * A negative deadline_usecs removes the deadline.
+ *
+ * The deadline stays until it is replaced or removed, also once it has passed, and only orders threads under
+ * UTHREAD_SCHED_EDF, where a READY thread moves to its new place at once. If no thread with ID tid exists, it is
+ * considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_deadline(int tid, int deadline_usecs);
+
+
+/**
+ * @brief Gives the thread with ID tid quantums of usecs micro-seconds instead of the global quantum_usecs; 0 restores
+ * the global quantum (adapted, with adaptive_quantum).
+ *
+ * The new length applies from the thread's next slice. A fixed quantum is never adapted. Has no effect in
+ * UTHREAD_TIMER_NONE mode. If no thread with ID tid exists, or usecs is negative, it is considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_quantum(int tid, int usecs);
+
+
 /**
  * @brief Terminates the thread with ID tid and deletes it from all relevant control structures.
  *
@@ -96,12 +429,50 @@ int uthread_resume(int tid);
 int uthread_sleep(int num_quantums);
 
 
+/**
+ * @brief Moves the RUNNING thread to the end of the READY queue and makes a scheduling decision.
+ *
+ * If no other thread is READY the calling thread simply continues. A new quantum starts for the next thread, but
+ * the preemption timer is not restarted, so a yield costs no system call. Any thread, including the main thread,
+ * may yield.
+ *
+ * @return 0.
+*/
+int uthread_yield();
+
+
+/**
+ * @brief Blocks the RUNNING thread for at least usecs micro-seconds of wall-clock (CLOCK_MONOTONIC) time.
+ *
+ * Immediately after the call a scheduling decision is made. Expired sleepers are checked whenever a new quantum
+ * starts, so the thread goes back to the end of the READY queue at the first quantum boundary after the deadline.
+ * A thread blocked with uthread_block while sleeping stays BLOCKED until it is resumed.
+ * It is considered an error if the main thread (tid == 0) calls this function, or if usecs is negative.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_usecs(int usecs);
+
+
+/*
+ * Library state read by the inline getters below. Not part of the API: use the getters.
+ */
+extern volatile int uthread_inline_tid; /* thread running on the only worker, -1 with several workers */
+extern volatile int uthread_inline_total_quantums;
+int uthread_get_tid_slow();
+
+
 /**
  * @brief Returns the thread ID of the calling thread.
  *
+ * Inline with a single worker; with several workers it asks the calling kernel thread's worker.
+ *
  * @return The ID of the calling thread.
 */
-int uthread_get_tid();
+inline int uthread_get_tid() {
+    int tid = uthread_inline_tid;
+    return tid >= 0 ? tid : uthread_get_tid_slow();
+}
 
 
 /**
@@ -112,7 +483,9 @@ int uthread_get_tid();
  *
  * @return The total number of quantums.
 */
-int uthread_get_total_quantums();
+inline int uthread_get_total_quantums() {
+    return uthread_inline_total_quantums;
+}
 
 
 /**
@@ -127,4 +500,487 @@ int uthread_get_total_quantums();
 int uthread_get_quantums(int tid);
 
 
+/**
+ * @brief Returns the state of the thread with ID tid, one of the UTHREAD_STATE_* values.
+ *
+ * Like uthread_get_quantums, this reads a copy the scheduler publishes: it takes no lock, makes no system call,
+ * and may be called from any kernel thread.
+ *
+ * @return On success, return the state of the thread with ID tid. On failure, return -1.
+*/
+int uthread_get_state(int tid);
+
+
+/**
+ * @brief Copies the tid, state, quantums and remaining sleep time of every existing thread into buf, in tid order.
+ *
+ * Threads that terminated but were not joined yet are included. Takes no lock and may be called from any kernel
+ * thread; each entry is consistent in itself, though threads may change state while the table is being copied.
+ *
+ * @return The number of entries written, at most n, or -1 on failure.
+*/
+int uthread_snapshot(uthread_snapshot_t* buf, int n);
+
+
+/* Synchronization
+ *
+ * A thread that has to wait on a mutex, condition variable or semaphore is parked: it leaves the READY queue until
+ * another thread hands the object over to it, so waiting costs no CPU time. Uncontended operations make no system
+ * call and never touch the preemption timer. A parked thread may still be blocked with uthread_block; it then stays
+ * BLOCKED after being handed the object, until it is resumed. uthread_resume does not wake a parked thread.
+ * Terminating a parked thread removes it from the wait queue; terminating the holder of a mutex leaves it locked.
+ */
+
+
+/**
+ * @brief Initializes m as unlocked. Equivalent to assigning UTHREAD_MUTEX_INITIALIZER.
+ *
+ * @return On success, return 0. On failure (null m), return -1.
+*/
+int uthread_mutex_init(uthread_mutex_t* m);
+
+
+/**
+ * @brief Checks that m is no longer in use. It is an error to destroy a locked mutex.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_destroy(uthread_mutex_t* m);
+
+
+/**
+ * @brief Locks m, parking the calling thread until it is unlocked if another thread holds it.
+ *
+ * Waiters acquire the mutex in FIFO order. It is an error to lock a mutex the calling thread already holds.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_lock(uthread_mutex_t* m);
+
+
+/**
+ * @brief Locks m only if it is unlocked, without waiting.
+ *
+ * @return 0 if the mutex was acquired, 1 if it is held (possibly by the calling thread), -1 on failure.
+*/
+int uthread_mutex_trylock(uthread_mutex_t* m);
+
+
+/**
+ * @brief Unlocks m. If threads are waiting, the oldest one becomes the holder and goes back to the READY queue.
+ *
+ * It is an error to unlock a mutex the calling thread does not hold.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_unlock(uthread_mutex_t* m);
+
+
+/**
+ * @brief Initializes c with no waiters. Equivalent to assigning UTHREAD_COND_INITIALIZER.
+ *
+ * @return On success, return 0. On failure (null c), return -1.
+*/
+int uthread_cond_init(uthread_cond_t* c);
+
+
+/**
+ * @brief Checks that c is no longer in use. It is an error to destroy a condition variable with waiters.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_destroy(uthread_cond_t* c);
+
+
+/**
+ * @brief Atomically unlocks m and parks the calling thread on c; returns with m locked again.
+ *
+ * A signalled waiter is moved straight to the wait queue of m instead of being woken to compete for it. As with
+ * pthreads, callers should re-check their predicate in a loop. It is an error to wait without holding m.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_wait(uthread_cond_t* c, uthread_mutex_t* m);
+
+
+/**
+ * @brief Wakes the oldest thread waiting on c, if any.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_signal(uthread_cond_t* c);
+
+
+/**
+ * @brief Wakes every thread waiting on c, if any.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_broadcast(uthread_cond_t* c);
+
+
+/**
+ * @brief Initializes s with value units. It is an error to pass a negative value.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_init(uthread_sem_t* s, int value);
+
+
+/**
+ * @brief Checks that s is no longer in use. It is an error to destroy a semaphore with waiters.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_destroy(uthread_sem_t* s);
+
+
+/**
+ * @brief Takes a unit from s, parking the calling thread until one is posted if none is available.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_wait(uthread_sem_t* s);
+
+
+/**
+ * @brief Takes a unit from s only if one is available, without waiting.
+ *
+ * @return 0 if a unit was taken, 1 if none is available, -1 on failure.
+*/
+int uthread_sem_trywait(uthread_sem_t* s);
+
+
+/**
+ * @brief Returns a unit to s, handing it to the oldest waiter if there is one.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_post(uthread_sem_t* s);
+
+
+/* I/O
+ *
+ * Parking a thread on a file descriptor lets the other threads run while it waits, instead of stopping all of them
+ * in a blocking system call. The library keeps one epoll set for all waiting threads; it is polled, without
+ * blocking, whenever a scheduling decision is made while some thread waits for I/O, and when no thread is READY
+ * the library blocks in epoll_wait instead of spinning. File descriptors used with the wrappers below must be in
+ * non-blocking mode (O_NONBLOCK), and must not be closed while a thread waits on them.
+ */
+
+
+/**
+ * @brief Parks the RUNNING thread until fd is ready for events or timeout_usecs micro-seconds have passed.
+ *
+ * events is a combination of UTHREAD_IO_READ and UTHREAD_IO_WRITE; errors and hang-ups on fd count as ready for
+ * both. A negative timeout_usecs waits without a time limit. At most one thread may wait to read and one to write
+ * on the same fd at any time: it is an error to wait for an event another thread already waits for on fd, to pass
+ * a negative fd or to pass no events.
+ *
+ * @return The subset of events that is ready, 0 on timeout, or -1 on failure (errno is set if the fd could not be
+ * added to the epoll set, e.g. EPERM for a regular file).
+*/
+int uthread_wait_fd(int fd, int events, int timeout_usecs);
+
+
+/**
+ * @brief Like read(2) on a non-blocking fd, parking the calling thread until data is available.
+ *
+ * @return As read(2).
+*/
+ssize_t uthread_read(int fd, void* buf, size_t count);
+
+
+/**
+ * @brief Like write(2) on a non-blocking fd, parking the calling thread until some data can be written.
+ *
+ * As with write(2), fewer than count bytes may be written.
+ *
+ * @return As write(2).
+*/
+ssize_t uthread_write(int fd, const void* buf, size_t count);
+
+
+/**
+ * @brief Like accept(2) on a non-blocking listening socket, parking the calling thread until a connection arrives.
+ *
+ * The accepted socket is created in non-blocking mode (and close-on-exec), ready for uthread_read and uthread_write.
+ *
+ * @return As accept(2).
+*/
+int uthread_accept(int fd, struct sockaddr* addr, socklen_t* addrlen);
+
+
+/**
+ * @brief Like pread(2), but parks only the calling thread until the read completes. Works on regular files; with an
+ * offset of -1 it reads at the file position like read(2), which also works on sockets and pipes.
+ *
+ * The operation is submitted asynchronously through the backend chosen by aio_backend. With io_uring, operations are
+ * queued in the submission ring and handed to the kernel in batches, with the other operations queued since the last
+ * batch: when the calling thread parks on it, when the running quantum ends, when no thread is READY, or at every
+ * scheduling decision in UTHREAD_TIMER_NONE mode. Counts above UINT32_MAX complete short. UTHREAD_AIO_SQPOLL lets a
+ * kernel thread pick them up without any system call. Completions are reaped at every scheduling decision, without a
+ * system call. Where io_uring is not available (or with UTHREAD_AIO_THREADS) the operations run as blocking calls on a
+ * few helper kernel threads. The backend is set up by the first call. If the calling thread is terminated before the
+ * operation completes, the operation still completes into buf.
+ *
+ * @return As pread(2).
+*/
+ssize_t uthread_pread(int fd, void* buf, size_t count, off_t offset);
+
+
+/**
+ * @brief Like pwrite(2), but parks only the calling thread until the write completes, like uthread_pread.
+ *
+ * @return As pwrite(2).
+*/
+ssize_t uthread_pwrite(int fd, const void* buf, size_t count, off_t offset);
+
+
+/* Channels
+ *
+ * A channel carries void* messages from any number of senders to one receiving thread at a time. Senders may be
+ * uthreads or any other kernel thread of the process (e.g. network or timer threads that are not library workers);
+ * sending never blocks and never takes a lock. A receiver that finds the channel empty is parked. A sender that is a
+ * uthread wakes it directly; any other thread rings a doorbell (an eventfd watched by the scheduler), which is the
+ * only system call on the send path and happens at most once per wake-up. Batch operations move several messages
+ * with a single wake-up.
+ */
+
+
+/**
+ * @brief Creates a channel that holds up to capacity messages (rounded up to a power of two, at most 2^30), or an
+ * unbounded channel if capacity is 0. Must be called from a uthread.
+ *
+ * @return The new channel, or NULL on failure.
+*/
+uthread_chan_t* uthread_chan_create(size_t capacity);
+
+
+/**
+ * @brief Destroys ch, dropping any messages left in it. Must be called from a uthread.
+ *
+ * It is an error to destroy a channel a thread is receiving on. No thread may send on ch during or after this call.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_destroy(uthread_chan_t* ch);
+
+
+/**
+ * @brief Sends msg on ch without waiting. May be called from any thread.
+ *
+ * @return 0 if msg was queued, 1 if a bounded channel is full (or no memory is left for an unbounded one), -1 on
+ * failure.
+*/
+int uthread_chan_send(uthread_chan_t* ch, void* msg);
+
+
+/**
+ * @brief Sends msgs[0 .. count-1] on ch in order, without waiting, waking the receiver at most once.
+ * May be called from any thread.
+ *
+ * @return The number of messages queued (fewer than count if a bounded channel filled up), or -1 on failure.
+*/
+int uthread_chan_send_batch(uthread_chan_t* ch, void* const* msgs, int count);
+
+
+/**
+ * @brief Receives the oldest message of ch into *msg, parking the calling thread while ch is empty.
+ *
+ * It is an error for a thread to receive on a channel another thread is parked receiving on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_recv(uthread_chan_t* ch, void** msg);
+
+
+/**
+ * @brief Receives the oldest message of ch into *msg if there is one, without waiting.
+ *
+ * @return 0 if a message was received, 1 if ch is empty, -1 on failure.
+*/
+int uthread_chan_try_recv(uthread_chan_t* ch, void** msg);
+
+
+/**
+ * @brief Receives up to max messages of ch into msgs, oldest first, parking the calling thread while ch is empty.
+ *
+ * @return The number of messages received (at least 1), or -1 on failure.
+*/
+int uthread_chan_recv_batch(uthread_chan_t* ch, void** msgs, int max);
+
+
+/**
+ * @brief Copies the scheduling statistics of the thread with ID tid into *out.
+ *
+ * Statistics are always collected; the time the thread has spent in its current state so far is included.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_stats(int tid, uthread_stats_t* out);
+
+
+/**
+ * @brief Writes the most recent scheduler events of every worker to fd, in Chrome trace-event JSON format.
+ *
+ * The output loads in chrome://tracing and Perfetto: each uthread is a track of run slices labelled with
+ * the reason the slice ended, and wake-ups are instant events. Requires a non-zero
+ * uthread_init_attr_t.trace_events.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_trace_dump(int fd);
+
+
+/**
+ * @brief Creates an empty task group.
+ *
+ * Tasks spawned on a group run on a small set of helper threads the library starts on first use
+ * (uthread_init_attr_t.task_workers of them), not on a thread of their own. A task may block, but it then holds
+ * on to its helper. Waiting for a group runs its unstarted tasks on the waiting thread.
+ *
+ * @return The new group, or nullptr on failure.
+*/
+uthread_taskgroup_t* uthread_taskgroup_create(void);
+
+
+/**
+ * @brief Frees a task group. It is an error to destroy a group with unfinished tasks or waiting threads.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_taskgroup_destroy(uthread_taskgroup_t* g);
+
+
+/**
+ * @brief Queues the call fn(arg) on g.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_taskgroup_spawn(uthread_taskgroup_t* g, uthread_task_fn fn, void* arg);
+
+
+/**
+ * @brief Waits until every task spawned on g so far has finished, running unstarted ones on the calling thread.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_taskgroup_wait(uthread_taskgroup_t* g);
+
+
+/**
+ * @brief Calls fn(b, e, ctx) over consecutive chunks [b, e) of [begin, end), grain indexes each (the last one may be
+ * shorter), on the task helper threads and the calling thread, and returns when every chunk has finished.
+ *
+ * One task describes the whole range, so the cost does not grow with the number of chunks beyond one call each.
+ * A grain of 0 picks one that gives every helper several chunks.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_parallel_for(long begin, long end, long grain, uthread_range_fn fn, void* ctx);
+
+
+/*
+ * Stackless coroutines. uthreads_coro.h (C++20) builds uthread::task<T> on the functions below, which only
+ * deal in opaque continuations so that the library itself stays C++14. Coroutines run one at a time on a
+ * single carrier thread, an ordinary thread the library spawns on first use and schedules like any other; it
+ * resumes every ready coroutine in turn, then yields, and parks while none is ready. A coroutine that calls a
+ * blocking thread function (uthread_mutex_lock, uthread_read, ...) blocks every coroutine with it: it should
+ * await the coroutine equivalents instead. These functions may be called from any of the library's threads,
+ * coroutines included.
+ */
+
+
+/**
+ * @brief Allocates a coroutine frame of size bytes from the library's frame arena, which recycles the frames of
+ * finished coroutines by size class.
+ *
+ * @return The frame, or nullptr on failure.
+*/
+void* uthread_coro_frame_alloc(size_t size);
+
+
+/**
+ * @brief Returns a frame obtained from uthread_coro_frame_alloc(size) to the arena.
+*/
+void uthread_coro_frame_free(void* frame, size_t size);
+
+
+/**
+ * @brief Queues w to be resumed by the carrier thread, after the coroutines already ready.
+ *
+ * @return On success, return 0. On failure (e.g. the carrier thread could not be spawned), return -1.
+*/
+int uthread_coro_post(uthread_coro_waiter_t* w);
+
+
+/**
+ * @brief Resumes w on the carrier thread once usecs micro-seconds have passed.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_coro_sleep_usecs(uthread_coro_waiter_t* w, int usecs);
+
+
+/**
+ * @brief Resumes w on the carrier thread once fd is ready for events or timeout_usecs micro-seconds have passed,
+ * with the ready events (0 on timeout) in w->revents.
+ *
+ * As for uthread_wait_fd, fd must be in non-blocking mode and a negative timeout_usecs waits without a time limit.
+ * At most one coroutine may wait on the same fd at any time.
+ *
+ * @return On success, return 0. On failure, return -1 (errno is set if the fd could not be added to the epoll set).
+*/
+int uthread_coro_wait_fd(uthread_coro_waiter_t* w, int fd, int events, int timeout_usecs);
+
+
+/*
+ * Thread-specific data. Native thread_local variables belong to the kernel thread and are shared by every thread
+ * running on it; a key gives each thread its own pointer instead, kept in a fixed array in the thread's control
+ * block, so that reading and writing it costs an index and no lock.
+ */
+
+
+/**
+ * @brief Creates a key whose value is nullptr in every thread, and stores it in *key.
+ *
+ * When a thread terminates with a non-null value for the key and destructor is set, destructor is called with the
+ * value, after the value is reset to nullptr. A thread that terminates itself (also by returning from its entry
+ * point) runs the destructors itself; if a destructor sets new values, the destructors run again, up to
+ * UTHREAD_DESTRUCTOR_ITERATIONS times. The destructors of a thread terminated by another thread run once, on the
+ * terminating thread, unless the terminated thread was running on another worker at the time. No destructors run
+ * when the process exits, including by terminating the main thread. It is an error if every key is in use.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_key_create(uthread_key_t* key, void (*destructor)(void*));
+
+
+/**
+ * @brief Deletes key. Its destructor is not called; the values threads set for it are forgotten and key may be
+ * returned again by uthread_key_create. It is an error if key was not created.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_key_delete(uthread_key_t key);
+
+
+/**
+ * @brief Returns the calling thread's value for key, nullptr if it has set none. Does not check that key was
+ * created, beyond its range.
+ *
+ * @return The value, or nullptr.
+*/
+void* uthread_getspecific(uthread_key_t key);
+
+
+/**
+ * @brief Sets the calling thread's value for key. It is an error if key was not created.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_setspecific(uthread_key_t key, const void* value);
+
+
 #endif
@@ -0,0 +1,358 @@
+/*
+ * User-Level Threads Library (uthreads)
+ * Stackless C++20 coroutine tasks, built on the uthread_coro_* functions of uthreads.h.
+ *
+ * Only this header needs C++20; the library itself is built as C++14, so programs that do not include it are not
+ * affected. A uthread::task<T> is a lazily started coroutine whose frame comes from the library's frame arena:
+ *
+ *     uthread::task<int> child(int fd) {
+ *         co_await uthread::wait_fd(fd, UTHREAD_IO_READ);
+ *         co_await uthread::sleep_for(std::chrono::milliseconds(5));
+ *         co_return 42;
+ *     }
+ *     uthread::task<> parent(int fd) {
+ *         int value = co_await child(fd);   // runs child and resumes once it finished
+ *         ...
+ *     }
+ *     uthread::spawn(parent(fd));                     // from a thread: start it and carry on
+ *     int value = uthread::block_on(child(fd));       // from a thread: start it and wait for its result
+ *
+ * Tasks run on the library's coroutine carrier thread, see uthreads.h.
+ */
+#ifndef _UTHREADS_CORO_H
+#define _UTHREADS_CORO_H
+
+#include "uthreads.h"
+
+#if !defined(__cpp_impl_coroutine)
+#error "uthreads_coro.h needs a C++20 compiler with coroutine support (-std=c++20)"
+#endif
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <system_error>
+#include <utility>
+
+namespace uthread {
+
+template <typename T = void>
+class task;
+
+int spawn(task<void> t);
+
+template <typename T>
+T block_on(task<T> t);
+
+namespace detail {
+
+inline void resume(void* address) {
+    std::coroutine_handle<>::from_address(address).resume();
+}
+
+/**
+ * @brief Makes w resume h once the library hands it back.
+ */
+inline void bind(uthread_coro_waiter_t& w, std::coroutine_handle<> h) {
+    w.fn = resume;
+    w.arg = h.address();
+}
+
+struct promise_base {
+    uthread_coro_waiter_t start{};           // queues the first resumption
+    std::coroutine_handle<> continuation;    // coroutine awaiting the task, resumed once it finished
+    uthread_sem_t* finished = nullptr;       // posted once it finished, for block_on
+    bool detached = false;                   // started by spawn: the frame frees itself
+    std::exception_ptr exception;
+
+    // uthread_coro_frame_alloc never returns nullptr: like every library allocation, it exits when out of memory
+    static void* operator new(std::size_t size) {
+        return uthread_coro_frame_alloc(size);
+    }
+
+    static void operator delete(void* frame, std::size_t size) noexcept {
+        uthread_coro_frame_free(frame, size);
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    struct final_awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            promise_base& p = h.promise();
+            if (p.continuation) {
+                return p.continuation;
+            }
+            if (p.detached) {
+                if (p.exception) {
+                    std::terminate();  // nobody to rethrow it to, as for a std::thread
+                }
+                h.destroy();
+            } else if (p.finished) {
+                // The waiting thread frees the frame, so it is not touched after this
+                uthread_sem_post(p.finished);
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        exception = std::current_exception();
+    }
+
+    void rethrow() const {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object() noexcept;
+
+    template <typename U = T>
+    void return_value(U&& v) {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T result() {
+        rethrow();
+        return std::move(*value);
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() const {
+        rethrow();
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief A coroutine returning T. It starts once awaited (co_await runs it and resumes the awaiting coroutine with
+ * its result, rethrowing its exception), passed to spawn or passed to block_on, and its frame is freed with the
+ * task object.
+ */
+template <typename T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+
+    task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+
+    T await_resume() {
+        return handle.promise().result();
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : handle(h) {}
+
+    friend promise_type;
+    friend int spawn(task<void> t);
+    template <typename U>
+    friend U block_on(task<U> t);
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept {
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/**
+ * @brief Starts t on the carrier thread without waiting for it; its frame is freed once it finishes. An exception
+ * escaping t calls std::terminate.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+inline int spawn(task<void> t) {
+    detail::promise<void>& p = t.handle.promise();
+    p.detached = true;
+    detail::bind(p.start, t.handle);
+    if (uthread_coro_post(&p.start) == -1) {
+        return -1;
+    }
+    t.handle = nullptr;
+    return 0;
+}
+
+/**
+ * @brief Starts t on the carrier thread and parks the calling thread until it finishes. Must be called from a thread,
+ * not from a task: the carrier would wait for itself.
+ *
+ * @return t's result; rethrows its exception, or throws std::system_error if t could not be started.
+*/
+template <typename T>
+T block_on(task<T> t) {
+    uthread_sem_t finished;
+    uthread_sem_init(&finished, 0);
+    detail::promise<T>& p = t.handle.promise();
+    p.finished = &finished;
+    detail::bind(p.start, t.handle);
+    if (uthread_coro_post(&p.start) == -1) {
+        uthread_sem_destroy(&finished);
+        throw std::system_error(EAGAIN, std::generic_category(), "uthread::block_on");
+    }
+    uthread_sem_wait(&finished);
+    uthread_sem_destroy(&finished);
+    return p.result();
+}
+
+/**
+ * @brief co_await yield() lets the other ready coroutines, and then the other threads, run before resuming.
+ */
+class yield_awaiter {
+public:
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        detail::bind(waiter, h);
+        return uthread_coro_post(&waiter) == 0;
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    uthread_coro_waiter_t waiter{};
+};
+
+inline yield_awaiter yield() noexcept {
+    return {};
+}
+
+/**
+ * @brief co_await sleep_usecs(usecs) resumes once usecs micro-seconds have passed; the carrier runs other
+ * coroutines meanwhile.
+ */
+class sleep_awaiter {
+public:
+    explicit sleep_awaiter(int usecs) noexcept : usecs(usecs) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        detail::bind(waiter, h);
+        return uthread_coro_sleep_usecs(&waiter, usecs) == 0;
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    uthread_coro_waiter_t waiter{};
+    int usecs;
+};
+
+inline sleep_awaiter sleep_usecs(int usecs) noexcept {
+    return sleep_awaiter(usecs);
+}
+
+template <typename Rep, typename Period>
+sleep_awaiter sleep_for(std::chrono::duration<Rep, Period> d) noexcept {
+    long long usecs = std::chrono::ceil<std::chrono::microseconds>(d).count();
+    return sleep_awaiter(usecs < 0 ? 0 : usecs > INT_MAX ? INT_MAX : (int)usecs);
+}
+
+/**
+ * @brief co_await wait_fd(fd, events, timeout_usecs) resumes once fd is ready for events or timeout_usecs
+ * micro-seconds have passed (never, if negative), with the ready events, 0 on timeout or -1 on failure (errno is
+ * set as by uthread_coro_wait_fd).
+ */
+class fd_awaiter {
+public:
+    fd_awaiter(int fd, int events, int timeout_usecs) noexcept :
+            fd(fd), events(events), timeout_usecs(timeout_usecs), failed(false) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept {
+        detail::bind(waiter, h);
+        failed = uthread_coro_wait_fd(&waiter, fd, events, timeout_usecs) != 0;
+        return !failed;
+    }
+
+    int await_resume() const noexcept {
+        return failed ? -1 : waiter.revents;
+    }
+
+private:
+    uthread_coro_waiter_t waiter{};
+    int fd;
+    int events;
+    int timeout_usecs;
+    bool failed;
+};
+
+inline fd_awaiter wait_fd(int fd, int events, int timeout_usecs = -1) noexcept {
+    return fd_awaiter(fd, events, timeout_usecs);
+}
+
+} // namespace uthread
+
+#endif // _UTHREADS_CORO_H